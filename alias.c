@@ -0,0 +1,149 @@
+#include "alias.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+typedef struct Alias {
+    char *name;
+    char *value;
+} Alias;
+
+// Open-addressing table keyed by alias name, kept at most half full
+static Alias *alias_table = NULL;
+static size_t alias_table_size = 0;
+static size_t alias_count = 0;
+
+static uint32_t alias_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+static Alias *find_slot(Alias *table, size_t size, const char *name) {
+    size_t slot = alias_hash(name) & (size - 1);
+    while (table[slot].name != NULL && strcmp(table[slot].name, name) != 0) {
+        slot = (slot + 1) & (size - 1);
+    }
+    return &table[slot];
+}
+
+static void grow_table(void) {
+    size_t new_size = alias_table_size ? alias_table_size * 2 : 64;
+    Alias *new_table = calloc(new_size, sizeof(Alias));
+    if (new_table == NULL) {
+        perror(RED "Error allocating alias table" RESET);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < alias_table_size; i++) {
+        if (alias_table[i].name != NULL) {
+            *find_slot(new_table, new_size, alias_table[i].name) = alias_table[i];
+        }
+    }
+    free(alias_table);
+    alias_table = new_table;
+    alias_table_size = new_size;
+}
+
+void define_alias(const char *name, const char *value) {
+    if (2 * (alias_count + 1) > alias_table_size) {
+        grow_table();
+    }
+
+    Alias *entry = find_slot(alias_table, alias_table_size, name);
+    char *value_copy = strdup(value);
+    if (value_copy == NULL) {
+        perror(RED "Error allocating alias" RESET);
+        return;
+    }
+    if (entry->name == NULL) {
+        entry->name = strdup(name);
+        if (entry->name == NULL) {
+            perror(RED "Error allocating alias" RESET);
+            free(value_copy);
+            return;
+        }
+        alias_count++;
+    } else {
+        free(entry->value);  // A later definition replaces the earlier one
+    }
+    entry->value = value_copy;
+}
+
+const char *find_alias(const char *name) {
+    if (alias_count == 0) {
+        return NULL;
+    }
+    Alias *entry = find_slot(alias_table, alias_table_size, name);
+    return entry->name != NULL ? entry->value : NULL;
+}
+
+static char *trim_whitespace(char *str) {
+    char *end;
+    while (isspace((unsigned char)*str)) str++;
+    if (*str == 0) return str;
+    end = str + strlen(str) - 1;
+    while (end > str && isspace((unsigned char)*end)) end--;
+    *(end + 1) = '\0';
+    return str;
+}
+
+void load_aliases(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(RED "Error opening .myshrc" RESET);
+        return;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int in_function = 0;
+    while (getline(&line, &line_size, file) != -1) {
+        char *trimmed = trim_whitespace(line);
+
+        // Function bodies are loaded by load_functions
+        if (strncmp(trimmed, "func ", 5) == 0) {
+            in_function = 1;
+            continue;
+        }
+        if (in_function) {
+            if (trimmed[0] == '}') in_function = 0;
+            continue;
+        }
+        if (trimmed[0] == '#') {
+            continue;
+        }
+
+        char *equals = strchr(trimmed, '=');
+        if (equals == NULL) {
+            continue;
+        }
+        *equals = '\0';
+        char *alias_key = trim_whitespace(trimmed);
+        char *alias_value = trim_whitespace(equals + 1);
+
+        if (strncmp(alias_key, "alias", 5) == 0 && isspace((unsigned char)alias_key[5])) {
+            alias_key = trim_whitespace(alias_key + 6);
+        }
+        if (alias_key[0] == '\0' || alias_key[strcspn(alias_key, " \t")] != '\0') {
+            continue;  // Alias names are single words
+        }
+
+        // Allow alias name='command' and alias name="command"
+        size_t value_len = strlen(alias_value);
+        if (value_len >= 2 && (alias_value[0] == '\'' || alias_value[0] == '"') &&
+            alias_value[value_len - 1] == alias_value[0]) {
+            alias_value[value_len - 1] = '\0';
+            alias_value++;
+        }
+
+        define_alias(alias_key, alias_value);
+    }
+    free(line);
+    fclose(file);
+}
@@ -0,0 +1,13 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+// Loads "name = command" (or "alias name = command") lines from the .myshrc file
+void load_aliases(const char *filename);
+
+// Adds or replaces an alias
+void define_alias(const char *name, const char *value);
+
+// Returns the expansion of an alias, or NULL if name is not an alias
+const char *find_alias(const char *name);
+
+#endif // ALIAS_H
@@ -0,0 +1,108 @@
+#include "arena.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *new_block(size_t size) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL) {
+        perror(RED "Error allocating arena block" RESET);
+        exit(EXIT_FAILURE);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size ? size : 1);
+
+    ArenaBlock *block = arena->current;
+    if (block == NULL || block->size - block->used < size) {
+        // Move on to the next kept block if it is big enough, or insert a new one
+        ArenaBlock *next = (block != NULL) ? block->next : NULL;
+        if (next != NULL && next->size >= size) {
+            next->used = 0;  // Blocks past current are only reset when reached
+            block = next;
+        } else {
+            size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+            ArenaBlock *created = new_block(block_size);
+            arena->capacity += block_size;
+            if (block == NULL) {
+                arena->first = created;
+            } else {
+                created->next = block->next;
+                block->next = created;
+            }
+            block = created;
+        }
+        arena->current = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    arena->last = ptr;
+    return ptr;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+    size_t length = strlen(str) + 1;
+    char *copy = arena_alloc(arena, length);
+    memcpy(copy, str, length);
+    return copy;
+}
+
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    ArenaBlock *block = arena->current;
+    size_t old_aligned = align_up(old_size ? old_size : 1);
+    size_t new_aligned = align_up(new_size);
+    if (ptr == arena->last && new_aligned >= old_aligned &&
+        block->size - block->used >= new_aligned - old_aligned) {
+        block->used += new_aligned - old_aligned;
+        arena->used += new_aligned - old_aligned;
+        if (arena->used > arena->peak) {
+            arena->peak = arena->used;
+        }
+        return ptr;
+    }
+
+    void *grown = arena_alloc(arena, new_size);
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+void arena_reset(Arena *arena) {
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+    arena->current = arena->first;
+    arena->last = NULL;
+    arena->used = 0;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->first;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    memset(arena, 0, sizeof(*arena));
+}
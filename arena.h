@@ -0,0 +1,37 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator: memory is handed out from large blocks and released all
+// at once by arena_reset, which keeps the blocks for the next use.
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;          // Usable bytes in data
+    size_t used;          // Bytes handed out from this block
+    char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *first;
+    ArenaBlock *current;  // Block allocations are currently served from
+    void *last;           // Most recent allocation, which arena_grow can extend in place
+    size_t used;          // Bytes handed out since the last reset
+    size_t peak;          // Largest value of used ever reached
+    size_t capacity;      // Total bytes held in blocks
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *str);
+
+// Resizes ptr (which must have been old_size bytes from this arena). The most
+// recent allocation is extended in place; anything else is copied.
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+// Releases everything allocated from the arena in O(1)
+void arena_reset(Arena *arena);
+
+// Returns all blocks to the system
+void arena_free(Arena *arena);
+
+#endif // ARENA_H
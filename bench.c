@@ -0,0 +1,160 @@
+#include "bench.h"
+#include "parser.h"
+#include "arena.h"
+#include "color.h"
+#include "launch.h"
+#include "pathcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static double elapsed_seconds(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+int bench_parse(const char *filename, int iterations) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(RED "Error opening benchmark input" RESET);
+        return EXIT_FAILURE;
+    }
+
+    // Load every line into memory so that only parsing is measured
+    char **lines = NULL;
+    size_t num_lines = 0, capacity = 0, total_bytes = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+        if (num_lines == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(lines, capacity * sizeof(char *));
+            if (grown == NULL) {
+                perror(RED "Error allocating memory" RESET);
+                return EXIT_FAILURE;
+            }
+            lines = grown;
+        }
+        lines[num_lines++] = strdup(line);
+        total_bytes += strlen(line);
+    }
+    free(line);
+    fclose(file);
+
+    if (num_lines == 0 || iterations < 1) {
+        fprintf(stderr, RED "Nothing to benchmark\n" RESET);
+        return EXIT_FAILURE;
+    }
+
+    Arena arena = {0};
+    size_t failures = 0, words = 0;
+    struct timespec begin, finish;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < num_lines; j++) {
+            CommandList *list = parse_command_line(lines[j], &arena);
+            if (list == NULL) {
+                failures++;
+            } else {
+                for (int k = 0; k < list->num_pipelines; k++) {
+                    for (int c = 0; c < list->pipelines[k].num_commands; c++) {
+                        words += list->pipelines[k].commands[c].argc;
+                    }
+                }
+            }
+            arena_reset(&arena);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    double seconds = elapsed_seconds(&begin, &finish);
+    double parsed = (double)num_lines * iterations;
+    printf("lines: %zu  iterations: %d  words/iteration: %zu  syntax errors/iteration: %zu\n",
+           num_lines, iterations, words / iterations, failures / iterations);
+    printf("total: %.3f s  per line: %.1f ns  throughput: %.1f MB/s\n",
+           seconds, seconds * 1e9 / parsed, total_bytes * (double)iterations / seconds / 1e6);
+    printf("arena peak: %zu bytes per line  arena capacity: %zu bytes\n", arena.peak, arena.capacity);
+
+    arena_free(&arena);
+    for (size_t j = 0; j < num_lines; j++) {
+        free(lines[j]);
+    }
+    free(lines);
+    return EXIT_SUCCESS;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int bench_spawn(const char *program, int iterations, int ballast_mb) {
+    const char *path = lookup_command_path(program);
+    if (path == NULL || iterations < 1) {
+        fprintf(stderr, RED "Usage: --bench-spawn [program] [iterations] [ballast_mb]\n" RESET);
+        return EXIT_FAILURE;
+    }
+
+    // Touch every page so that fork has to copy real page tables
+    size_t ballast_size = (size_t)ballast_mb * 1024 * 1024;
+    char *ballast = NULL;
+    if (ballast_size > 0) {
+        ballast = malloc(ballast_size);
+        if (ballast == NULL) {
+            perror(RED "Error allocating ballast" RESET);
+            return EXIT_FAILURE;
+        }
+        memset(ballast, 1, ballast_size);
+    }
+
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    char *argv[] = { (char *)program, NULL };
+    LaunchSpec spec = { -1, null_fd, 0 };
+    double *samples = malloc(iterations * sizeof(double));
+    if (samples == NULL) {
+        perror(RED "Error allocating memory" RESET);
+        return EXIT_FAILURE;
+    }
+
+    printf("program: %s  iterations: %d  ballast: %d MB\n", path, iterations, ballast_mb);
+    printf("%-8s %10s %10s %10s %10s\n", "strategy", "mean us", "p50 us", "p99 us", "min us");
+
+    LaunchStrategy saved = launch_strategy;
+    for (int strategy = LAUNCH_SPAWN; strategy <= LAUNCH_FORK; strategy++) {
+        launch_strategy = strategy;
+        double total = 0;
+        int failed = 0;
+        for (int i = 0; i < iterations; i++) {
+            struct timespec begin, finish;
+            clock_gettime(CLOCK_MONOTONIC, &begin);
+            pid_t pid = launch_program(path, argv, &spec);
+            if (pid < 0) {
+                failed = 1;
+                break;
+            }
+            waitpid(pid, NULL, 0);
+            clock_gettime(CLOCK_MONOTONIC, &finish);
+            samples[i] = elapsed_seconds(&begin, &finish) * 1e6;
+            total += samples[i];
+        }
+        if (failed) {
+            perror(RED "Error launching benchmark program" RESET);
+            break;
+        }
+        qsort(samples, iterations, sizeof(double), compare_doubles);
+        printf("%-8s %10.1f %10.1f %10.1f %10.1f\n", launch_strategy_name(strategy),
+               total / iterations, samples[iterations / 2],
+               samples[(int)(iterations * 0.99)], samples[0]);
+    }
+    launch_strategy = saved;
+
+    free(samples);
+    free(ballast);
+    close(null_fd);
+    return EXIT_SUCCESS;
+}
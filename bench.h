@@ -0,0 +1,13 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Parses every line of a file repeatedly without executing anything and
+// reports the per-line parse cost. Returns the process exit status.
+int bench_parse(const char *filename, int iterations);
+
+// Launches a program repeatedly with every launch strategy and reports the
+// per-launch latency. ballast_mb grows the shell's memory first, since fork
+// gets slower as the parent's page tables grow.
+int bench_spawn(const char *program, int iterations, int ballast_mb);
+
+#endif // BENCH_H
@@ -0,0 +1,439 @@
+#include "builtin.h"
+#include "command.h"
+#include "hop.h"
+#include "reveal.h"
+#include "log.h"
+#include "color.h"
+#include "iman.h"
+#include "signal.h"
+#include "seek.h"
+#include "proclore.h"
+#include "neonate.h"
+#include "jobs.h"
+#include "events.h"
+#include "pathcache.h"
+#include "parallel.h"
+#include "histsearch.h"
+#include "logstats.h"
+#include "copyfd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+extern char current_command[256];  // Buffer to store the current command
+
+// log search callback: prints a match with the index 'log execute' takes
+static int print_match(int index, const char *command, size_t length, void *arg) {
+    printf("%d\t%.*s\n", index, (int)length, command);
+    return 0;
+}
+
+// Joins argv[first..argc) with single spaces, e.g. a search pattern
+static char *join_arguments(int argc, char **argv, int first, ShellContext *ctx) {
+    size_t length = 1;
+    for (int i = first; i < argc; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+    char *joined = arena_alloc(ctx->arena, length);
+    joined[0] = '\0';
+    for (int i = first; i < argc; i++) {
+        if (i > first) strcat(joined, " ");
+        strcat(joined, argv[i]);
+    }
+    return joined;
+}
+
+static int builtin_log(int argc, char **argv, ShellContext *ctx) {
+    if (argc == 1) {
+        print_log();  // Print the log file content
+    } else if (strcmp(argv[1], "execute") == 0) {
+        int index = (argc > 2) ? atoi(argv[2]) : 0;  // Extract index from command
+        if (index <= 0) {
+            printf(RED "Invalid index.\n" RESET);
+            return 1;
+        }
+        char *cmd_to_execute = get_command_from_log(index);
+        if (cmd_to_execute == NULL) {
+            printf(RED "Invalid command index.\n" RESET);
+            return 1;
+        }
+        // Recursively call process_command with the retrieved command
+        process_command(cmd_to_execute, ctx->home_dir);
+        free(cmd_to_execute);  // Free the command retrieved from log
+    } else if (strcmp(argv[1], "purge") == 0) {
+        log_purge();  // Clear the log file
+    } else if (strcmp(argv[1], "search") == 0 && argc > 2 && strcmp(argv[2], "-i") == 0) {
+        // Interactive search; the chosen command is run like 'log execute'
+        char *chosen = history_search_interactive(argc > 3 ? join_arguments(argc, argv, 3, ctx) : NULL);
+        if (chosen != NULL) {
+            process_command(chosen, ctx->home_dir);
+            free(chosen);
+        }
+    } else if (strcmp(argv[1], "search") == 0 && argc > 2) {
+        log_search(join_arguments(argc, argv, 2, ctx), print_match, NULL);
+    } else if (strcmp(argv[1], "stats") == 0) {
+        print_log_stats();
+    } else if (strcmp(argv[1], "sync") == 0) {
+        log_sync();  // Write out the queued commands now
+    } else {
+        printf(RED "Usage: log [purge | execute <index> | search [-i] <pattern> | stats | sync]\n" RESET);
+        return 1;
+    }
+    return 0;
+}
+
+static int builtin_hop(int argc, char **argv, ShellContext *ctx) {
+    if (argc == 1) {
+        hop_command(ctx->home_dir, "~");  // No argument, go to home directory
+    }
+    for (int i = 1; i < argc; i++) {
+        hop_command(ctx->home_dir, argv[i]);
+    }
+    return 0;
+}
+
+static int builtin_reveal(int argc, char **argv, ShellContext *ctx) {
+    char *flags = NULL;
+    char *path = NULL;
+
+    // Collect flags and path
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (flags == NULL) {
+                flags = arena_strdup(ctx->arena, argv[i]);
+            } else {
+                size_t length = strlen(flags);
+                flags = arena_grow(ctx->arena, flags, length + 1, length + strlen(argv[i]));
+                strcpy(flags + length, argv[i] + 1);  // Skip the leading '-'
+            }
+        } else {
+            path = argv[i];
+            break;
+        }
+    }
+
+    reveal_command(flags, path != NULL ? path : ".", ctx->home_dir);
+    return 0;
+}
+
+static int builtin_exit(int argc, char **argv, ShellContext *ctx) {
+    cleanup_log();  // Write out the history that is still queued
+    exit(EXIT_SUCCESS);  // Exit the program
+}
+
+static int builtin_neonate(int argc, char **argv, ShellContext *ctx) {
+    if (argc < 3 || strcmp(argv[1], "-n") != 0) {
+        printf(RED "Usage: neonate -n <time_arg>\n" RESET);
+        return 1;
+    }
+    int time_arg = atoi(argv[2]);  // Extract time argument
+    if (time_arg <= 0) {
+        printf(RED "Invalid time argument.\n" RESET);
+        return 1;
+    }
+    neonate(time_arg);
+    return 0;
+}
+
+static int builtin_proclore(int argc, char **argv, ShellContext *ctx) {
+    proclore(argc > 1 ? argv[1] : NULL);
+    return 0;
+}
+
+// Lists jobs by command name, each with its job number for fg/bg %N
+static int builtin_activities(int argc, char **argv, ShellContext *ctx) {
+    // Catch up on stops and continues that have not been read yet
+    events_poll();
+    for (int i = 0; i < job_count(); i++) {
+        Job *job = job_at(i);
+        const char *state = get_process_state(job->pid);
+        printf("%%%d [%d] : %s - %s\n", job->id, job->pid, job->command, state);
+    }
+    return 0;
+}
+
+// Checks that a process exists before it is resumed
+// Reads the pid fg or bg act on: %N names job N, anything else is the pid
+// of a job. Returns 0 if there is no such job; other processes are not ours
+// to continue or wait for.
+static pid_t job_argument(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, RED "Usage: %s <pid | %%job>\n" RESET, argv[0]);
+        return 0;
+    }
+    if (argv[1][0] == '%') {
+        Job *job = find_job(atoi(argv[1] + 1));
+        if (job == NULL) {
+            fprintf(stderr, RED "No such job: %s\n" RESET, argv[1]);
+            return 0;
+        }
+        return job->pid;
+    }
+    pid_t pid = atoi(argv[1]);
+    if (pid <= 0 || find_process(pid) == NULL) {
+        fprintf(stderr, RED "No such job: %s\n" RESET, argv[1]);
+        return 0;
+    }
+    return pid;
+}
+
+static int builtin_bg(int argc, char **argv, ShellContext *ctx) {
+    pid_t pid = job_argument(argc, argv);
+    if (pid <= 0) {
+        return 1;
+    }
+    send_signal(pid, SIGCONT);
+    return 0;
+}
+
+static int builtin_fg(int argc, char **argv, ShellContext *ctx) {
+    pid_t pid = job_argument(argc, argv);
+    if (pid <= 0) {
+        return 1;
+    }
+
+    // Send SIGCONT to the process to resume it if it's stopped
+    if (kill(pid, SIGCONT) == -1) {
+        perror(RED "Error sending SIGCONT to process" RESET);
+    }
+    strncpy(current_command, get_process_name(pid), sizeof(current_command) - 1);
+    // The job is in the foreground now; it rejoins the list if it stops again
+    remove_process(pid);
+    wait_foreground(pid);
+    return 0;
+}
+
+static int builtin_iman(int argc, char **argv, ShellContext *ctx) {
+    if (argc < 2) {
+        printf(RED "Usage: iMan <command_name>\n" RESET);
+        return 1;
+    }
+    fetch_man_page(argv[1]);
+    return 0;
+}
+
+static int builtin_ping(int argc, char **argv, ShellContext *ctx) {
+    if (argc != 3) {  // Expecting exactly 3 arguments: "ping", "<pid>", "<signal_number>"
+        printf(RED "Usage: ping <pid> <signal_number>\n" RESET);
+        return 1;
+    }
+    send_signal(atoi(argv[1]), atoi(argv[2]));
+    return 0;
+}
+
+static int builtin_seek(int argc, char **argv, ShellContext *ctx) {
+    if (argc < 2) {
+        printf(RED "Usage: seek <flags> <search> <target_directory>\n" RESET);
+        return 1;
+    }
+    seek_command_handler(argv, argc, ctx->home_dir);
+    return 0;
+}
+
+// hash            list cached command locations
+// hash -r         forget every cached location
+// hash <name>...  look names up on PATH and cache them
+static int builtin_hash(int argc, char **argv, ShellContext *ctx) {
+    if (argc == 1) {
+        print_command_paths();
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            clear_command_paths();
+        } else if (lookup_command_path(argv[i]) == NULL) {
+            fprintf(stderr, RED "hash: %s: not found\n" RESET, argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// cat <file>...   copy regular files to stdout without forking
+// Only invocations the program would handle the same way end up here (see
+// cat_handles); options, stdin and devices are left to /bin/cat.
+static int builtin_cat(int argc, char **argv, ShellContext *ctx) {
+    fflush(stdout);  // Written straight to the descriptor from here on
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 && copy_fd(fd, STDOUT_FILENO) == 0) {
+            close(fd);
+            continue;
+        }
+        int error = errno;
+        if (fd >= 0) close(fd);
+        if (error == EINTR) {
+            return 130;  // Ctrl-C, like a program killed by SIGINT
+        }
+        if (error == EPIPE) {
+            return 1;  // Whoever reads the output stopped
+        }
+        fprintf(stderr, RED "cat: %s: %s\n" RESET, argv[i], strerror(error));
+        status = 1;
+    }
+    return status;
+}
+
+// Whether the cat builtin copies exactly what /bin/cat would: only plain
+// operands naming regular files, so it never reads a terminal or a device
+// that does not end
+static int cat_handles(int argc, char **argv) {
+    if (argc < 2) {
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (argv[i][0] == '-' || stat(argv[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// parallel [-j N] [-k] [-a file] [command [args...]]
+// Runs one job per line of stdin (or file), N at a time (default: one per
+// CPU). Without a command each line is a command line; with one, each line
+// is appended to it as a single argument. -k prints output in input order.
+static int builtin_parallel(int argc, char **argv, ShellContext *ctx) {
+    ParallelOptions options = { 0, 0, STDIN_FILENO, NULL, 0 };
+    const char *input_file = NULL;
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-k") == 0) {
+            options.keep_order = 1;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            options.max_jobs = atoi(count);
+            if (options.max_jobs <= 0) {
+                fprintf(stderr, RED "parallel: invalid job count '%s'\n" RESET, count);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            input_file = argv[++i];
+        } else {
+            fprintf(stderr, RED "Usage: parallel [-j N] [-k] [-a file] [command [args...]]\n" RESET);
+            return 1;
+        }
+    }
+    if (i < argc) {
+        options.command = argv + i;
+        options.command_argc = argc - i;
+    }
+    if (options.max_jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        options.max_jobs = (cpus > 0) ? cpus : 1;
+    }
+
+    if (input_file != NULL) {
+        options.input_fd = open(input_file, O_RDONLY | O_CLOEXEC);
+        if (options.input_fd < 0) {
+            perror(RED "parallel: Error opening input file" RESET);
+            return 1;
+        }
+    }
+    int status = run_parallel(&options, ctx);
+    if (input_file != NULL) {
+        close(options.input_fd);
+    }
+    return status;
+}
+
+#include "builtin_table.h"
+
+// FNV-1a, folded so that the low bits depend on every byte.
+// Must match fnv1a() in tools/gen_builtin_table.py.
+static uint32_t builtin_name_hash(const char *name, uint32_t seed) {
+    uint32_t h = seed;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+// Builtins added with register_builtin, in an open-addressing table
+static Builtin *registered = NULL;
+static size_t registered_size = 0;
+static size_t registered_count = 0;
+
+static Builtin *find_registered(const char *name) {
+    if (registered_size == 0) {
+        return NULL;
+    }
+    size_t slot = builtin_name_hash(name, BUILTIN_HASH_SEED) & (registered_size - 1);
+    while (registered[slot].name != NULL) {
+        if (strcmp(registered[slot].name, name) == 0) {
+            return &registered[slot];
+        }
+        slot = (slot + 1) & (registered_size - 1);
+    }
+    return NULL;
+}
+
+static void insert_registered(const char *name, builtin_handler handler) {
+    size_t slot = builtin_name_hash(name, BUILTIN_HASH_SEED) & (registered_size - 1);
+    while (registered[slot].name != NULL) {
+        slot = (slot + 1) & (registered_size - 1);
+    }
+    registered[slot].name = name;
+    registered[slot].handler = handler;
+}
+
+builtin_handler find_builtin(const char *name) {
+    const Builtin *entry = &builtin_table[builtin_name_hash(name, BUILTIN_HASH_SEED) & (BUILTIN_TABLE_SIZE - 1)];
+    if (entry->name != NULL && strcmp(entry->name, name) == 0) {
+        return entry->handler;
+    }
+
+    const Builtin *extra = find_registered(name);
+    return (extra != NULL) ? extra->handler : NULL;
+}
+
+builtin_handler find_builtin_for(int argc, char **argv) {
+    builtin_handler handler = find_builtin(argv[0]);
+    if (handler == builtin_cat && !cat_handles(argc, argv)) {
+        return NULL;
+    }
+    return handler;
+}
+
+int register_builtin(const char *name, builtin_handler handler) {
+    if (find_builtin(name) != NULL) {
+        return -1;
+    }
+
+    // Keep the table at most half full
+    if (2 * (registered_count + 1) > registered_size) {
+        Builtin *old = registered;
+        size_t old_size = registered_size;
+        registered_size = old_size ? old_size * 2 : 16;
+        registered = calloc(registered_size, sizeof(Builtin));
+        if (registered == NULL) {
+            perror(RED "Error allocating builtin table" RESET);
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < old_size; i++) {
+            if (old[i].name != NULL) {
+                insert_registered(old[i].name, old[i].handler);
+            }
+        }
+        free(old);
+    }
+
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        perror(RED "Error registering builtin" RESET);
+        return -1;
+    }
+    insert_registered(copy, handler);
+    registered_count++;
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include "arena.h"
+
+// State handed to every builtin
+typedef struct ShellContext {
+    char *home_dir;       // Directory the shell was started in ("~")
+    int background;       // 1 if the command was launched with '&'
+    Arena *arena;         // Per-line arena, released after the line finishes
+} ShellContext;
+
+typedef int (*builtin_handler)(int argc, char **argv, ShellContext *ctx);
+
+typedef struct Builtin {
+    const char *name;
+    builtin_handler handler;
+} Builtin;
+
+// Returns the handler for a builtin whose name is exactly name, or NULL
+builtin_handler find_builtin(const char *name);
+
+// Returns the handler that runs this command line, or NULL if it is left to
+// a program. Unlike find_builtin it looks at the arguments: a builtin that
+// shadows a program only takes the invocations it supports in full.
+builtin_handler find_builtin_for(int argc, char **argv);
+
+// Adds a builtin at runtime. Returns 0 on success or -1 if the name is taken.
+int register_builtin(const char *name, builtin_handler handler);
+
+#endif // BUILTIN_H
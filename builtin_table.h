@@ -0,0 +1,26 @@
+// Generated by tools/gen_builtin_table.py. Do not edit by hand.
+#ifndef BUILTIN_TABLE_H
+#define BUILTIN_TABLE_H
+
+#define BUILTIN_HASH_SEED 102u
+#define BUILTIN_TABLE_SIZE 32
+
+static const Builtin builtin_table[BUILTIN_TABLE_SIZE] = {
+    [2] = { "neonate", builtin_neonate },
+    [3] = { "hop", builtin_hop },
+    [5] = { "fg", builtin_fg },
+    [8] = { "hash", builtin_hash },
+    [14] = { "ping", builtin_ping },
+    [17] = { "proclore", builtin_proclore },
+    [18] = { "exit", builtin_exit },
+    [20] = { "parallel", builtin_parallel },
+    [21] = { "seek", builtin_seek },
+    [22] = { "iMan", builtin_iman },
+    [23] = { "reveal", builtin_reveal },
+    [24] = { "bg", builtin_bg },
+    [26] = { "cat", builtin_cat },
+    [28] = { "activities", builtin_activities },
+    [30] = { "log", builtin_log },
+};
+
+#endif // BUILTIN_TABLE_H
@@ -1,653 +1,547 @@
+#define _GNU_SOURCE  // pipe2
 #include "command.h"
-#include "hop.h"
-#include "reveal.h"
 #include "log.h"
-#include "fcntl.h"
+#include <fcntl.h>
 #include "color.h"
 #include <stdio.h>
-#include "iman.h"
 #include "signal.h"
-#include "seek.h"
 #include "custom.h"
 #include <stdlib.h>
-#include "proclore.h"
 #include <string.h>
 #include <time.h>
-#include "neonate.h"
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <errno.h>
-#include "linkedlist.h"
-#include <ctype.h>
-
-// Struct to hold alias and command pair
-typedef struct Alias {
-    char alias[50];
-    char command[256];
-} Alias;
-
-#define MAX_ALIASES 100
-Alias alias_table[MAX_ALIASES];
-int alias_count = 0;
-
-char *trim_whitespace(char *str) {
-    char *end;
-    while (isspace((unsigned char)*str)) str++;
-    if (*str == 0) return str;
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
-    *(end + 1) = '\0';
-    return str;
-}
+#include <limits.h>
+#include "jobs.h"
+#include "parser.h"
+#include "arena.h"
+#include "builtin.h"
+#include "pathcache.h"
+#include "launch.h"
+#include "fanout.h"
+#include "events.h"
+
+// Applies the '<', '>' and '>>' redirections of a command to the current process
+static int apply_redirections(const SimpleCommand *cmd) {
+    if (cmd->input_file != NULL) {
+        int fd_in = open(cmd->input_file, O_RDONLY);
+        if (fd_in < 0) {
+            if (errno == ENOENT) {
+                fprintf(stderr, RED "No such input file found!\n" RESET);
+            } else {
+                perror(RED "Error opening input file" RESET);
+            }
+            return -1;
+        }
+        dup2(fd_in, STDIN_FILENO);
+        close(fd_in);
+    }
 
-void replace_tabs_with_spaces(char* str){
-    for (int i = 0; str[i] != '\0'; i++){
-        if (str[i]=='\t'){
-            str[i]=' ';
+    if (cmd->output_file != NULL) {
+        int fd_out = open(cmd->output_file, O_WRONLY | O_CREAT | (cmd->append ? O_APPEND : O_TRUNC), 0644);
+        if (fd_out < 0) {
+            perror(RED "Error opening output file" RESET);
+            return -1;
         }
+        dup2(fd_out, STDOUT_FILENO);
+        close(fd_out);
     }
+    return 0;
 }
 
-void load_aliases(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror(RED "Error opening .myshrc" RESET);
+static int64_t time_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+// Logs a finished command with how long it took, how it ended and where it ran
+static void handle_log_command(const char *command, const struct timeval *started,
+                               const char *cwd, int status) {
+    // Check if the command contains "log"
+    if (strstr(command, "log") != NULL) {
         return;
     }
 
-    char line[256];
-    while (fgets(line, sizeof(line), file) != NULL) {
-        char *alias_key = strtok(line, "=");
-        char *alias_value = strtok(NULL, "=");
-        
-        if (alias_key && alias_value) {
-            alias_key = trim_whitespace(alias_key);
-            alias_value = trim_whitespace(alias_value);
-            alias_value[strcspn(alias_value, "\n")] = '\0';  // Remove newline
-            
-            if (alias_count < MAX_ALIASES) {
-                strncpy(alias_table[alias_count].alias, alias_key, sizeof(alias_table[alias_count].alias) - 1);
-                strncpy(alias_table[alias_count].command, alias_value, sizeof(alias_table[alias_count].command) - 1);
-                alias_count++;
+    struct timeval finished;
+    gettimeofday(&finished, NULL);
+    LogEntry entry = {
+        command, strlen(command), cwd, strlen(cwd),
+        time_us(started), time_us(&finished) - time_us(started), status, getpid()
+    };
+    log_command(&entry);
+}
+
+extern void display_prompt(const char *home_dir); // Forward declaration of display_prompt function
+
+double elapsed_time = 0;  // Global variable definition
+char current_command[256];
+
+static Arena line_arena;       // Backs every allocation made while running one input line
+static int command_depth = 0;  // Nesting of process_command (log execute, custom functions)
+static int last_status = 0;    // Wait status of the last foreground program
+
+struct timeval start, end;
+
+// Waits for foreground children. Any that stop (Ctrl-Z) become background
+// jobs under the matching name. Returns the wait status of the last child.
+static int wait_children(const pid_t *pids, const char *const *names, int count) {
+    // Ctrl-C and Ctrl-Z are passed on to the last process
+    foreground_pid = pids[count - 1];
+    int *statuses = arena_alloc(&line_arena, count * sizeof(int));
+    events_wait_children(pids, count, statuses);
+    foreground_pid = -1; // Reset after the process finishes
+
+    gettimeofday(&end, NULL);
+    elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    for (int i = 0; i < count; i++) {
+        if (WIFSTOPPED(statuses[i])) {
+            printf("Stopped foreground process PID: %d\n", pids[i]);
+            add_process(pids[i], names[i]);
+            set_process_state(pids[i], JOB_STOPPED);
+        }
+    }
+    last_status = statuses[count - 1];
+    return last_status;
+}
+
+int wait_foreground(pid_t pid) {
+    const char *name = current_command;
+    return wait_children(&pid, &name, 1);
+}
+
+// Opens the redirection targets of a command for a child to inherit.
+// The descriptors are close-on-exec; the launcher installs them as fd 0 and 1.
+static int open_redirections(const SimpleCommand *cmd, int *in_fd, int *out_fd) {
+    *in_fd = -1;
+    *out_fd = -1;
+    if (cmd->input_file != NULL) {
+        *in_fd = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+        if (*in_fd < 0) {
+            if (errno == ENOENT) {
+                fprintf(stderr, RED "No such input file found!\n" RESET);
             } else {
-                fprintf(stderr,RED "Alias limit reached. Cannot add more aliases.\n" RESET);
-                break;
+                perror(RED "Error opening input file" RESET);
             }
+            return -1;
         }
     }
-    fclose(file);
-}
 
-#define MAX_COMMAND_LENGTH 1024
-
-void replace_alias(char *command) {
-    char temp[MAX_COMMAND_LENGTH];
-    strcpy(temp, command);  // Copy the original command to a temp buffer
-
-    for (int i = 0; i < alias_count; i++) {
-        char *pos;
-        // Search for the alias in the command string
-        while ((pos = strstr(temp, alias_table[i].alias)) != NULL) {
-            char new_command[MAX_COMMAND_LENGTH] = "";  // Buffer to store the modified command
-            size_t alias_len = strlen(alias_table[i].alias);
-            
-            // Copy the part before the alias
-            strncat(new_command, temp, pos - temp);
-            
-            // Add the command that corresponds to the alias
-            strcat(new_command, alias_table[i].command);
-            
-            // Add the rest of the original string after the alias
-            strcat(new_command, pos + alias_len);
-            
-            // Update the temp command with the new command (with alias replaced)
-            strcpy(temp, new_command);
+    if (cmd->output_file != NULL) {
+        *out_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append ? O_APPEND : O_TRUNC), 0644);
+        if (*out_fd < 0) {
+            perror(RED "Error opening output file" RESET);
+            if (*in_fd >= 0) close(*in_fd);
+            return -1;
         }
     }
+    return 0;
+}
 
-    // Copy the modified command back to the original command buffer
-    strcpy(command, temp);
+static void close_redirections(int in_fd, int out_fd) {
+    if (in_fd >= 0) close(in_fd);
+    if (out_fd >= 0) close(out_fd);
 }
 
-void handle_redirection(char* command, char *home_dir) {
-    char* input_file = NULL;
-    char* output_file = NULL;
-    int append_mode = 0;
-
-    char* in_redirect = strstr(command, "<");
-    char* out_redirect = strstr(command, ">");
-    
-    if (in_redirect != NULL) {
-        *in_redirect = '\0';
-        input_file = strtok(in_redirect + 1, " \t\n");
-        if (input_file != NULL && access(input_file, F_OK) == -1) {
-            fprintf(stderr,RED "No such input file found!\n" RESET);
-        }
+static void report_launch_error(const char *name) {
+    if (errno == ENOENT || errno == EACCES || errno == ENOTDIR) {
+        printf(RED "ERROR : '%s' is not a valid command\n" RESET, name);
+    } else {
+        perror(RED "Error launching command" RESET);
     }
+}
 
-    if (out_redirect != NULL) {
-        append_mode = (*(out_redirect + 1) == '>') ? 1 : 0;
-        *out_redirect = '\0';
-        output_file = strtok(out_redirect + 1 + append_mode, " \t\n");
+// Launches a program with in_fd/out_fd (when >= 0) as its stdin/stdout,
+// unless the command redirects them itself, and starts watching it.
+// Returns its pid, or -1 after reporting why it could not be started.
+static pid_t launch_external(const SimpleCommand *cmd, int in_fd, int out_fd, int new_group) {
+    // Resolve the program in the shell so the cache outlives the child
+    const char *path = lookup_command_path(cmd->argv[0]);
+    if (path == NULL) {
+        printf(RED "ERROR : '%s' is not a valid command\n" RESET, cmd->argv[0]);
+        return -1;
     }
 
-    int saved_stdin = dup(STDIN_FILENO);
-    int saved_stdout = dup(STDOUT_FILENO);
+    int redirect_in, redirect_out;
+    if (open_redirections(cmd, &redirect_in, &redirect_out) != 0) {
+        return -1;
+    }
+    LaunchSpec spec = {
+        redirect_in >= 0 ? redirect_in : in_fd,
+        redirect_out >= 0 ? redirect_out : out_fd,
+        new_group
+    };
+
+    fflush(stdout);
+    pid_t pid = launch_program(path, cmd->argv, &spec);
+    close_redirections(redirect_in, redirect_out);
+    if (pid < 0) {
+        report_launch_error(cmd->argv[0]);
+        return -1;
+    }
+    events_watch_child(pid);
+    return pid;
+}
 
-    if (input_file != NULL) {
-        int fd_in = open(input_file, O_RDONLY);
-        if (fd_in < 0) {
-            perror(RED "Error opening input file" RESET);
-            return;
-        }
-        dup2(fd_in, STDIN_FILENO);
-        close(fd_in);
+void execute_command(const SimpleCommand *cmd, int background) {
+    char **args = cmd->argv;
+    pid_t pid = launch_external(cmd, -1, -1, background);
+    if (pid < 0) {
+        return;
     }
 
-    if (output_file != NULL) {
-        int fd_out = open(output_file, O_WRONLY | O_CREAT | (append_mode ? O_APPEND : O_TRUNC), 0644);
-        if (fd_out < 0) {
-            perror(RED "Error opening output file" RESET);
-            return;
-        }
-        dup2(fd_out, STDOUT_FILENO);
-        close(fd_out);
+    if (background) {
+        foreground_pid=-1;
+          // Store the background process PID and command name
+        add_process(pid, args[0]);
+        // Print PID of the background process
+        printf("Started background process PID: %d\n", pid);
+    } else {
+        strncpy(current_command, args[0], sizeof(current_command) - 1);
+        wait_foreground(pid);
     }
+}
 
-    process_command(command, home_dir);
+// Returns 1 if the command runs inside the shell rather than as a program
+static int is_builtin(const SimpleCommand *cmd) {
+    return find_builtin_for(cmd->argc, cmd->argv) != NULL || is_custom_function(cmd->argv[0]);
+}
+
+// Runs the command if it is a custom function or a builtin.
+// Returns 1 if it was handled, 0 if it should be executed as a program.
+static int run_builtin(const SimpleCommand *cmd, ShellContext *ctx) {
+    if (execute_custom_function(cmd->argc, cmd->argv, ctx->home_dir) == 1) {
+        return 1;
+    }
+
+    builtin_handler handler = find_builtin_for(cmd->argc, cmd->argv);
+    if (handler == NULL) {
+        return 0;
+    }
+    // Stands in for a wait status, so the log can tell how it went
+    last_status = (handler(cmd->argc, cmd->argv, ctx) & 0xff) << 8;
+    return 1;
+}
+
+// Runs a builtin inside the shell with its stdin/stdout temporarily replaced by
+// in_fd/out_fd (when >= 0) and then by the command's own redirections
+static void run_builtin_redirected(const SimpleCommand *cmd, ShellContext *ctx, int in_fd, int out_fd) {
+    fflush(stdout);
+    int saved_stdin = dup(STDIN_FILENO);
+    int saved_stdout = dup(STDOUT_FILENO);
+
+    // A reader that exits early must not kill the shell with SIGPIPE
+    void (*saved_sigpipe)(int) = SIG_DFL;
+    if (out_fd >= 0) saved_sigpipe = signal(SIGPIPE, SIG_IGN);
+
+    if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    if (apply_redirections(cmd) == 0) {
+        run_builtin(cmd, ctx);
+        fflush(stdout);
+    }
 
     dup2(saved_stdin, STDIN_FILENO);
     dup2(saved_stdout, STDOUT_FILENO);
+    clearerr(stdout);
+    if (out_fd >= 0) signal(SIGPIPE, saved_sigpipe);
 
     close(saved_stdin);
     close(saved_stdout);
 }
 
-// Function to handle pipes
-void handle_pipes(char* command, char* home_dir) {
-    char* pipe_segments[10]; // Assuming a maximum of 10 pipes
-    int num_pipes = 0;
+// Runs a builtin with its stdin/stdout temporarily redirected
+void handle_redirection(const SimpleCommand *cmd, ShellContext *ctx) {
+    run_builtin_redirected(cmd, ctx, -1, -1);
+}
+
+// Forks a child that runs a builtin pipeline stage
+static pid_t fork_builtin_stage(const SimpleCommand *cmd, ShellContext *ctx,
+                                int in_fd, int out_fd, const int *pipefds, int num_fds) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    events_after_fork();
+
+    if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    // Close all pipe file descriptors (important!)
+    for (int i = 0; i < num_fds; i++) {
+        close(pipefds[i]);
+    }
+    if (apply_redirections(cmd) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    run_builtin(cmd, ctx);
+    fflush(stdout);
+    exit(0);
+}
+
+// One command of a pipeline together with the descriptors it is wired to
+typedef struct Stage {
+    const SimpleCommand *cmd;
+    int in_fd;            // -1 to read the shell's stdin
+    int out_fd;           // -1 to write to the shell's stdout
+    pid_t pid;
+} Stage;
+
+// Appends the commands of a pipeline to stages, reading first_in and writing
+// last_out at its ends and taking the pipes in between from pipefds
+static void wire_stages(const Pipeline *pipeline, int first_in, int last_out,
+                        const int *pipefds, int *next_pipe, Stage *stages, int *num_stages) {
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        Stage *stage = &stages[(*num_stages)++];
+        stage->cmd = &pipeline->commands[i];
+        stage->in_fd = (i == 0) ? first_in : pipefds[(*next_pipe - 1) * 2];
+        if (i == pipeline->num_commands - 1) {
+            stage->out_fd = last_out;
+        } else {
+            stage->out_fd = pipefds[*next_pipe * 2 + 1];
+            (*next_pipe)++;
+        }
+        stage->pid = -1;
+    }
+}
 
-    char *saveptr;
-    char *token = strtok_r(command, "|", &saveptr);
-    while (token != NULL && num_pipes < 10) {
-        pipe_segments[num_pipes++] = strdup(token);
-        token = strtok_r(NULL, "|", &saveptr);
+// Function to handle pipes of any length. External stages are launched with
+// the pipe ends as their stdin/stdout. The last builtin stage of a foreground
+// pipeline runs inside the shell: every stage after it is an already running
+// program that keeps draining its output, so it cannot stall. Other builtin
+// stages are forked.
+//
+// With '|+' the output of the pipeline goes to a pipe that the shell copies
+// into one pipe per branch with tee/splice (see fanout.c), so the shell is
+// busy and every builtin is forked. A background fan-out forks a helper to
+// do the copying.
+void handle_pipes(const Pipeline *pipeline, ShellContext *ctx) {
+    int num_stages = pipeline->num_commands;
+    int num_pipes = pipeline->num_commands - 1;
+    int num_branches = pipeline->num_branches;
+    if (num_branches > 0) {
+        num_pipes++;  // Producer to shell
+        for (int b = 0; b < num_branches; b++) {
+            num_stages += pipeline->branches[b].num_commands;
+            num_pipes += pipeline->branches[b].num_commands;  // Shell to branch, then within it
+        }
     }
+    int num_fds = 2 * num_pipes;
+    int *pipefds = arena_alloc(&line_arena, num_fds * sizeof(int));
+    Stage *stages = arena_alloc(&line_arena, num_stages * sizeof(Stage));
 
-    // Check for invalid pipe usage
+    // Create pipes; close-on-exec keeps them out of every launched program
     for (int i = 0; i < num_pipes; i++) {
-        if (strlen(pipe_segments[i]) == 0) {
-            fprintf(stderr, RED "Invalid use of pipe\n" RESET);
+        if (pipe2(pipefds + i * 2, O_CLOEXEC) < 0) {
+            // E.g. out of descriptors in a long pipeline: nothing was started yet
+            perror(RED "Pipe creation failed" RESET);
+            for (int j = 0; j < i * 2; j++) {
+                close(pipefds[j]);
+            }
+            last_status = 1 << 8;
+            return;
         }
     }
 
-    if (num_pipes > 1) {
-        int pipefds[2 * (num_pipes - 1)];
+    int next_pipe = 0;
+    num_stages = 0;
+    int fanout_in = -1;
+    int *branch_outs = NULL;
+    if (num_branches == 0) {
+        wire_stages(pipeline, -1, -1, pipefds, &next_pipe, stages, &num_stages);
+    } else {
+        int fanout_pipe = next_pipe++;
+        fanout_in = pipefds[fanout_pipe * 2];
+        wire_stages(pipeline, -1, pipefds[fanout_pipe * 2 + 1], pipefds, &next_pipe, stages, &num_stages);
+        branch_outs = arena_alloc(&line_arena, num_branches * sizeof(int));
+        for (int b = 0; b < num_branches; b++) {
+            int branch_pipe = next_pipe++;
+            branch_outs[b] = pipefds[branch_pipe * 2 + 1];
+            wire_stages(&pipeline->branches[b], pipefds[branch_pipe * 2], -1,
+                        pipefds, &next_pipe, stages, &num_stages);
+        }
+    }
 
-        // Create pipes
-        for (int i = 0; i < num_pipes - 1; i++) {
-            if (pipe(pipefds + i * 2) < 0) {
-                perror(RED "Pipe creation failed" RESET);
-                exit(EXIT_FAILURE);
+    int inline_stage = -1;
+    if (!pipeline->background && num_branches == 0) {
+        for (int i = num_stages - 1; i >= 0 && inline_stage < 0; i--) {
+            if (is_builtin(stages[i].cmd)) {
+                inline_stage = i;
             }
         }
+    }
+
+    fflush(stdout);
+    for (int i = 0; i < num_stages; i++) {
+        Stage *stage = &stages[i];
+        const SimpleCommand *cmd = stage->cmd;
 
-        for (int cmd_num = 0; cmd_num < num_pipes; cmd_num++) {
-            pid_t pid = fork();
-            if (pid == 0) {
-                // Child process
-
-                // If it's not the first command, get input from the previous pipe
-                if (cmd_num != 0) {
-                    dup2(pipefds[(cmd_num - 1) * 2], STDIN_FILENO);
-                }
-
-                // If it's not the last command, output to the next pipe
-                if (cmd_num != num_pipes - 1) {
-                    dup2(pipefds[cmd_num * 2 + 1], STDOUT_FILENO);
-                }
-
-                // Close all pipe file descriptors (important!)
-                for (int i = 0; i < 2 * (num_pipes - 1); i++) {
-                    close(pipefds[i]);
-                }
-
-                // Execute the command
-                process_command(pipe_segments[cmd_num], home_dir);
-                exit(0); // Ensure child exits after executing the command
-            } else if (pid < 0) {
+        if (i == inline_stage) {
+            continue;  // Runs below, once every other stage has started
+        }
+        if (is_builtin(cmd)) {
+            // Other builtins need a copy of the shell, so only they are forked
+            stage->pid = fork_builtin_stage(cmd, ctx, stage->in_fd, stage->out_fd, pipefds, num_fds);
+            if (stage->pid < 0) {
                 perror(RED "fork" RESET);
-                exit(EXIT_FAILURE);
+            } else {
+                events_watch_child(stage->pid);
             }
+            continue;
         }
 
-        // Parent process: Close all pipes
-        for (int i = 0; i < 2 * (num_pipes - 1); i++) {
-            close(pipefds[i]);
-        }
+        stage->pid = launch_external(cmd, stage->in_fd, stage->out_fd, pipeline->background);
+    }
 
-        // Wait for all child processes to finish
-        for (int i = 0; i < num_pipes; i++) {
-            wait(NULL);
+    // The shell keeps only the descriptors it still has to use: those of the
+    // inline stage, or the two ends of the fan-out copy. Closing the rest lets
+    // every stage see end-of-file as soon as the stage before it is done.
+    int keep_in = -1, keep_out = -1;
+    if (inline_stage >= 0) {
+        keep_in = stages[inline_stage].in_fd;
+        keep_out = stages[inline_stage].out_fd;
+    }
+    for (int i = 0; i < num_fds; i++) {
+        int fd = pipefds[i];
+        int keep = (fd == keep_in || fd == keep_out || fd == fanout_in);
+        for (int b = 0; b < num_branches && !keep; b++) {
+            keep = (fd == branch_outs[b]);
+        }
+        if (!keep) {
+            close(fd);
         }
     }
 
-    // Free allocated memory for pipe segments
-    for (int i = 0; i < num_pipes; i++) {
-        free(pipe_segments[i]);
+    pid_t fanout_pid = -1;
+    if (inline_stage >= 0) {
+        run_builtin_redirected(stages[inline_stage].cmd, ctx, keep_in, keep_out);
+        if (keep_in >= 0) close(keep_in);
+        if (keep_out >= 0) close(keep_out);
+    } else if (num_branches > 0) {
+        if (pipeline->background) {
+            fanout_pid = fork();
+            if (fanout_pid == 0) {
+                exit(fanout_copy(fanout_in, branch_outs, num_branches) == 0 ? 0 : EXIT_FAILURE);
+            }
+            if (fanout_pid < 0) {
+                perror(RED "fork" RESET);
+            } else {
+                events_watch_child(fanout_pid);
+            }
+        } else {
+            fanout_copy(fanout_in, branch_outs, num_branches);
+        }
+        close(fanout_in);
+        for (int b = 0; b < num_branches; b++) {
+            close(branch_outs[b]);
+        }
     }
-}
 
-static void handle_log_command(const char *command, const char *home_dir) {
-    // Check if the command contains "log"
-    if (strstr(command, "log") != NULL) {
+    if (pipeline->background) {
+        for (int i = 0; i < num_stages; i++) {
+            if (stages[i].pid > 0) {
+                add_process(stages[i].pid, stages[i].cmd->argv[0]);
+                printf("Started background process PID: %d\n", stages[i].pid);
+            }
+        }
+        if (fanout_pid > 0) {
+            add_process(fanout_pid, "|+");
+        }
         return;
     }
 
-    // Set the log directory based on the home directory
-    set_log_directory(home_dir);
-
-    // Check if the command is the same as the last one
-    static char *last_command = NULL;  // Store the last command
-    if (last_command != NULL && strcmp(last_command, command) == 0) {
-        return;
+    // Wait for all child processes to finish
+    pid_t *pids = arena_alloc(&line_arena, num_stages * sizeof(pid_t));
+    const char **names = arena_alloc(&line_arena, num_stages * sizeof(char *));
+    int num_children = 0;
+    for (int i = 0; i < num_stages; i++) {
+        if (stages[i].pid > 0) {
+            pids[num_children] = stages[i].pid;
+            names[num_children++] = stages[i].cmd->argv[0];
+        }
     }
-
-    // Update the last command
-    if (last_command != NULL) {
-        free(last_command);
+    if (num_children > 0) {
+        wait_children(pids, names, num_children);
     }
-    last_command = strdup(command);
-
-    // Trim the log file if necessary
-    trim_log_file();
-
-    // Log the command
-    log_command(command);
 }
 
-extern void display_prompt(const char *home_dir); // Forward declaration of display_prompt function
-
-double elapsed_time = 0;  // Global variable definition
-char current_command[256];
+static void execute_pipeline(const Pipeline *pipeline, char *home_dir) {
+    ShellContext ctx = { home_dir, pipeline->background, &line_arena };
 
-static void background_process_handler(int sig) {
-    int status;
-    pid_t pid;
-     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        const char *command_name = get_process_name(pid);
-        if (WIFEXITED(status)) {
-            printf("Background process %d (%s) ended normally with exit status %d\n", pid, command_name, WEXITSTATUS(status));
-        } else if (WIFSIGNALED(status)) {
-            printf("Background process %d (%s) ended abnormally with signal %d\n", pid, command_name, WTERMSIG(status));
-        }
-        remove_process(pid);  // Clean up process list
+    if (pipeline->num_commands > 1 || pipeline->num_branches > 0) {
+        handle_pipes(pipeline, &ctx);
+        return;
     }
-}
 
-struct timeval start, end,end2;
-void execute_command(const char *cmd, int background) {
-    // Tokenize the command string into an array of arguments
-char *args[256];
-char *cmd_copy = strdup(cmd);
-if (cmd_copy == NULL) {
-    perror(RED "Error duplicating command" RESET);
-    return;
-}
-
-int i = 0;
-int in_quotes = 0;
-char *arg_start = NULL;
-
-for (char *token = cmd_copy; *token != '\0'; token++) {
-    if (*token == '"' || *token == '\'') {  // Check for quotes
-        in_quotes = !in_quotes;  // Toggle in_quotes flag
-        if (in_quotes) {
-            arg_start = token + 1;  // Start after the opening quote
-        } else {
-            *token = '\0';  // End the quoted argument
-            args[i++] = strdup(arg_start);  // Save the quoted argument
-            arg_start = NULL;  // Reset arg_start
-        }
-    } else if (*token == ' ' && !in_quotes) {  // Space outside of quotes
-        if (arg_start != NULL) {  // If there's an ongoing argument
-            *token = '\0';  // End the argument
-            args[i++] = strdup(arg_start);  // Save the argument
-            arg_start = NULL;  // Reset arg_start
-        }
-    } else if (arg_start == NULL) {
-        arg_start = token;  // Start of a new argument
+    const SimpleCommand *cmd = &pipeline->commands[0];
+    if (!is_builtin(cmd)) {
+        execute_command(cmd, pipeline->background);
+    } else if (cmd->input_file != NULL || cmd->output_file != NULL) {
+        handle_redirection(cmd, &ctx);
+    } else {
+        run_builtin(cmd, &ctx);
     }
 }
 
-// Add the last argument if there's any
-if (arg_start != NULL && *arg_start != '\0') {
-    args[i++] = strdup(arg_start);
-}
-
-args[i] = NULL;  // NULL-terminate the argument list
-free(cmd_copy);
-
-if (args[0] == NULL) {
-    return;
-}
-    // Fork and execute the command
+pid_t start_command_list(const CommandList *list, char *home_dir, int in_fd, int out_fd) {
+    const Pipeline *pipeline = &list->pipelines[0];
+    if (list->num_pipelines == 1 && pipeline->num_commands == 1 && pipeline->num_branches == 0 &&
+        !pipeline->background && !is_builtin(&pipeline->commands[0])) {
+        return launch_external(&pipeline->commands[0], in_fd, out_fd, 0);
+    }
 
+    // Builtins, pipelines and sequences need a copy of the shell
+    fflush(stdout);
     pid_t pid = fork();
-    // setpgid(pid, pid);  // Set child as its own group leader
     if (pid < 0) {
-        perror(RED "fork failed" RESET);
-        return;
-    } else if (pid == 0) {  // Child process
-    if(background){
-        setpgid(pid,pid);
+        perror(RED "fork" RESET);
+        return -1;
     }
-        if (execvp(args[0], args) < 0) {
-            printf(RED "ERROR : '%s' is not a valid command\n" RESET,cmd);
-            exit(EXIT_FAILURE);
-        }
-    } else {  // Parent process
-        if (background) {
-            foreground_pid=-1;
-              // Store the background process PID and command name
-            add_process(pid, args[0]);
-            // Print PID of the background process
-            printf("Started background process PID: %d\n", pid);
-            // Set up signal handler for background processes
-            signal(SIGCHLD, background_process_handler);
-        } else {
-            // Set the global foreground PID
-            foreground_pid = pid;
-            strcpy(current_command,args[0]);
-            // Wait for the foreground process to finish
-            int status;
-            if (waitpid(pid, &status, WUNTRACED) < 0) {
-                perror(RED "waitpid failed" RESET);
-            } else {
-                gettimeofday(&end, NULL);
-                elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
-            }
-            foreground_pid = -1; // Reset after the process finishes
-        }
+    if (pid > 0) {
+        events_watch_child(pid);
+        return pid;
     }
-
-    // Free dynamically allocated arguments
-    for (int j = 0; j < i; j++) {
-        free(args[j]);
+    events_after_fork();
+    if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    last_status = 0;
+    for (int i = 0; i < list->num_pipelines; i++) {
+        execute_pipeline(&list->pipelines[i], home_dir);
     }
+    fflush(stdout);
+    if (WIFSIGNALED(last_status)) {
+        exit(128 + WTERMSIG(last_status));
+    }
+    exit(WIFEXITED(last_status) ? WEXITSTATUS(last_status) : 0);
 }
 
-
 void process_command(const char *command, char *home_dir) {
     gettimeofday(&start, NULL);
-     // Log the command before processing it
-    handle_log_command(command, home_dir);
-    
-    // Make a modifiable copy of the command for strtok_r
-    char *cmd_copy = strdup(command);
-    if (cmd_copy == NULL) {
-        perror(RED "Error duplicating command" RESET);
-        // return;
-    }
-    replace_tabs_with_spaces(cmd_copy);
-    // Replace alias if exists
-    replace_alias(cmd_copy);
-
-    // Split the input command by ';' to handle multiple commands
-    char *cmd_segment;
-    char *saveptr_segments;  // Save pointer for splitting by ';'
-    cmd_segment = strtok_r(cmd_copy, ";", &saveptr_segments);
-
-    while (cmd_segment != NULL) {
-        // Trim leading/trailing whitespace
-        while (isspace(*cmd_segment)) cmd_segment++;
-        char *end = cmd_segment + strlen(cmd_segment) - 1;
-        while (end > cmd_segment && isspace(*end)) end--;
-        *(end + 1) = '\0';
-
-        // Split the command segment by '&' to identify background execution
-        char *background_cmd;
-        char *saveptr_background;
-    int counter=0;for(int i=0;i<strlen(cmd_segment);i++){if(cmd_segment[i]=='&')counter++;}
-        background_cmd = strtok_r(cmd_segment, "&", &saveptr_background);
-        // printf("%s\n",saveptr_background);
-
-        while (background_cmd != NULL) {
-            // Trim leading/trailing whitespace for each background command
-            while (isspace(*background_cmd)) background_cmd++;
-            end = background_cmd + strlen(background_cmd) - 1;
-            while (end > background_cmd && isspace(*end)) end--;
-            *(end + 1) = '\0';
-
-            if (strlen(background_cmd) > 0) {
-                int background = counter--;
-
-            // Check if the command contains pipes
-            if (strchr(background_cmd, '|') != NULL) {
-                // Command contains pipes
-                handle_pipes(background_cmd, home_dir);
-            } 
-            // Check if the command contains redirection operators
-            else if (strchr(background_cmd, '<') != NULL || strchr(background_cmd, '>') != NULL) {
-                // Command contains redirection operators
-                handle_redirection(background_cmd, home_dir);
-            } 
-                //seding to custom command here
-                // Check for "log execute" command and handle it
-            else if(execute_custom_function(background_cmd,home_dir)==1){}
-            else if (strncmp(background_cmd, "log execute", 11) == 0) {
-                int index = atoi(background_cmd + 12);  // Extract index from command
-                if (index > 0) {
-                    char *cmd_to_execute = get_command_from_log(index);
-                    if (cmd_to_execute != NULL) {
-                        // printf("Executing command from log: %s\n", cmd_to_execute);
-                        // Recursively call process_command with the retrieved command
-                        process_command(cmd_to_execute, home_dir);
-                        free(cmd_to_execute);  // Free the command retrieved from log
-                    } else {
-                        printf(RED "Invalid command index.\n" RESET);
-                    }
-                } else {
-                    printf(RED "Invalid index.\n" RESET);
-                }
-            }
-
-                // Handle specific commands
-                else if (strncmp(background_cmd, "hop", 3) == 0) {
-                    if (strlen(background_cmd) == 3) {
-                        hop_command(home_dir, "~");  // No argument, go to home directory
-                    } else {
-                        char *args[256];
-                        int i = 0;
-                        char *saveptr_hop_args;  // Save pointer for splitting hop command arguments
-                        char *token = strtok_r(background_cmd, " ", &saveptr_hop_args);
-                        while (token != NULL && i < sizeof(args)/sizeof(args[0]) - 1) {
-                            args[i++] = token;
-                            token = strtok_r(NULL, " ", &saveptr_hop_args);
-                        }
-                        args[i] = NULL;  // NULL-terminate the argument list
-
-                        for (int j = 1; j < i; j++) {
-                            hop_command(home_dir, args[j]);
-                        }
-                    }
-                } else if (strncmp(background_cmd, "reveal", 6) == 0) {
-                    char *args[256];
-                    int i = 0;
-                    char *saveptr_reveal_args;  // Save pointer for splitting reveal command arguments
-                    char *token = strtok_r(background_cmd, " ", &saveptr_reveal_args);
-                    while (token != NULL && i < sizeof(args)/sizeof(args[0]) - 1) {
-                        args[i++] = token;
-                        token = strtok_r(NULL, " ", &saveptr_reveal_args);
-                    }
-                    args[i] = NULL;  // NULL-terminate the argument list
-
-                    char *flags = NULL;
-                    char *path = NULL;
-
-                    // Collect flags and path
-                    for (int j = 1; j < i; j++) {
-                        if (args[j][0] == '-') {
-                            if (flags == NULL) {
-                                flags = strdup(args[j]);
-                            } else {
-                                char *temp = malloc(strlen(flags) + strlen(args[j]) + 1);
-                                if (temp == NULL) {
-                                    perror(RED "Error allocating memory" RESET);
-                                    free(cmd_copy);
-                                }
-                                strcpy(temp, flags);
-                                strcat(temp, args[j] + 1);  // Skip the leading '-'
-                                free(flags);
-                                flags = temp;
-                            }
-                        } else {
-                            path = args[j];
-                            break;
-                        }
-                    }
-
-                    if (path == NULL) {
-                        path = ".";
-                    }
-
-                    reveal_command(flags, path, home_dir);
-
-                    if (flags != NULL) {
-                        free(flags);
-                    }
-                } else if (strncmp(background_cmd, "exit", 4) == 0) {
-                    // printf("Exiting shell...\n");
-                    exit(EXIT_SUCCESS);  // Exit the program
-                }
-                else if (strncmp(background_cmd, "neonate -n", 10) == 0) {
-                    int time_arg = atoi(background_cmd + 11);  // Extract time argument
-                    if (time_arg > 0) {
-                        neonate(time_arg);  // Call the neonate function
-                    } else {
-                        printf(RED "Invalid time argument.\n" RESET);
-                    }
-                }  else if (strncmp(background_cmd, "log purge", 9) == 0) {
-                    log_purge();  // Clear the log file
-                    // printf("Log file purged.\n");
-                }
-                else if (strncmp(command, "proclore", 8) == 0) {
-                    const char *pid_str = command + 9;  // Extract PID string
-                    proclore(pid_str);
-                }
-                
-
-                else if (strncmp(background_cmd, "activities", 10) == 0) {
-                    sort_process_list();
-                    ProcessNode *current = get_process_list_head();                    
-                    while (current) {
-                        const char *state = get_process_state(current->pid);
-                        printf("[%d] : %s - %s\n", current->pid, current->command, state);
-                        current = current->next;
-                    }
-                }
-                else if (strcmp(background_cmd, "log") == 0 ) {
-                    print_log();  // Print the log file content
-                }// Check for the "ping" command and handle it
-                else if(strncmp(background_cmd,"bg",2)==0){
-                    int index = atoi(background_cmd + 3);  // Extract index from command
-                 // Check if the process exists
-                    if (kill(index, 0) == -1) {
-                        if (errno == ESRCH) {
-                            fprintf(stderr,RED "No such process found\n" RESET);
-                        } else {
-                            perror(RED "Error sending signal" RESET);
-                        }
-                    }
-                    else
-                    send_signal(index,18);
-                }
-                else if(strncmp(background_cmd,"fg",2)==0){
-                    int index = atoi(background_cmd + 3);  // Extract index from command
-                 // Check if the process exists
-                    if (kill(index, 0) == -1) {
-                        if (errno == ESRCH) {
-                            fprintf(stderr,RED "No such process found\n" RESET);
-                        } else {
-                            perror(RED "Error sending signal" RESET);
-                        }
-                    }
-                    // Send SIGCONT to the process to resume it if it's stopped
-                    if (kill(index, SIGCONT) == -1) {
-                        perror(RED "Error sending SIGCONT to process" RESET);
-                    }
-                    // Set the global foreground PID
-                    foreground_pid = index;
-                    const char* name=get_process_name(index);
-                    strcpy(current_command,name);
-                    // Wait for the foreground process to finish
-                    int status;
-                    if (waitpid(index, &status, WUNTRACED) < 0) {
-                        perror(RED "waitpid failed" RESET);
-                    } else {
-                        gettimeofday(&end2, NULL);
-                        elapsed_time = (end2.tv_sec - start.tv_sec) + (end2.tv_usec - start.tv_usec) / 1000000.0;
-                    }
-                    remove_process(foreground_pid);
-                    foreground_pid = -1; // Reset after the process finishes
-                }else if (strncmp(background_cmd, "iMan", 4) == 0) {
-                    char *cmd_name = strtok(background_cmd + 5, " ");  // Extract the command name after 'iMan '
-                    if (cmd_name) {
-                        fetch_man_page(cmd_name);
-                    } else {
-                        printf(RED "Usage: iMan <command_name>\n" RESET);
-                    }
-                }
-                else if (strncmp(background_cmd, "ping", 4) == 0) {
-                    char *args[256];
-                    int i = 0;
-                    char *saveptr_ping_args;  // Save pointer for splitting ping command arguments
-                    char *token = strtok_r(background_cmd, " ", &saveptr_ping_args);
-                    while (token != NULL && i < sizeof(args) / sizeof(args[0]) - 1) {
-                        args[i++] = token;
-                        token = strtok_r(NULL, " ", &saveptr_ping_args);
-                    }
-                    args[i] = NULL;  // NULL-terminate the argument list
-
-                    if (i == 3) {  // Expecting exactly 3 arguments: "ping", "<pid>", "<signal_number>"
-                        pid_t pid = atoi(args[1]);
-                        int signal_number = atoi(args[2]);
-                        send_signal(pid, signal_number);
-                    } else {
-                        printf(RED "Usage: ping <pid> <signal_number>\n" RESET);
-                    }
-                }else if (strncmp(background_cmd, "seek", 4) == 0) {
-                    char *args[256];
-                    int i = 0;
-                    char *saveptr_seek_args;  // Save pointer for splitting seek command arguments
-                    char *token = strtok_r(background_cmd, " ", &saveptr_seek_args);
-                    while (token != NULL && i < sizeof(args)/sizeof(args[0]) - 1) {
-                        args[i++] = token;
-                        token = strtok_r(NULL, " ", &saveptr_seek_args);
-                    }
-                    args[i] = NULL;  // NULL-terminate the argument list
-
-                    if (i > 1) {
-                        // Handle seek command
-                        seek_command_handler(args, i,home_dir);
-                    } else {
-                        printf(RED "Usage: seek <flags> <search> <target_directory>\n" RESET);
-                    }
-                } else {
-                    // Execute other commands
-                    execute_command(background_cmd, background);
-                }
-            }
-
-            background_cmd = strtok_r(NULL, "&", &saveptr_background);
+    struct timeval started = start;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+    last_status = 0;
+
+    // Everything below is allocated from the line arena, which is released
+    // in one step once the outermost command has finished
+    command_depth++;
+
+    // Parse the whole line once into pipelines, commands and redirections,
+    // expanding aliases as they are found
+    CommandList *list = parse_command_line(command, &line_arena);
+    if (list != NULL) {
+        for (int i = 0; i < list->num_pipelines; i++) {
+            execute_pipeline(&list->pipelines[i], home_dir);
         }
+    }
 
-        cmd_segment = strtok_r(NULL, ";", &saveptr_segments);
+    if (--command_depth == 0) {
+        arena_reset(&line_arena);
     }
 
-    free(cmd_copy);
+    // Logged once it has finished, so the entry can say how it went
+    handle_log_command(command, &started, cwd, last_status);
 }
-
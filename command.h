@@ -1,8 +1,24 @@
 #ifndef COMMAND_H
 #define COMMAND_H
+
+#include <sys/types.h>
+#include "parser.h"
+
 extern double elapsed_time;
 
 void process_command(const char *command, char *home_dir);
-void load_aliases(const char *filename);
+
+// Waits for a foreground child to exit or stop, recording how long the
+// command took. A child that stops becomes a background job.
+// Returns the wait status.
+int wait_foreground(pid_t pid);
+
+// Starts a parsed line as a single child with in_fd/out_fd (when >= 0) as
+// its stdin/stdout, without waiting for it. A lone program is launched
+// directly; builtins, pipelines and ';' sequences run in a forked copy of the
+// shell, which exits with the status of its last program. The child is
+// watched (see events.h) but not added to the job list.
+// Returns its pid, or -1 if nothing could be started.
+pid_t start_command_list(const CommandList *list, char *home_dir, int in_fd, int out_fd);
 
 #endif
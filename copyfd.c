@@ -0,0 +1,108 @@
+#define _GNU_SOURCE  // splice
+#include "copyfd.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+// The shell reads SIGINT through its signalfd, so while a builtin copies,
+// Ctrl-C only leaves it pending. It is checked between chunks and taken, so
+// that it ends the copy instead of reaching the prompt afterwards.
+static int interrupted(void) {
+    sigset_t pending;
+    if (sigpending(&pending) != 0 || !sigismember(&pending, SIGINT)) {
+        return 0;
+    }
+    sigset_t sigint;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    struct timespec now = { 0, 0 };
+    sigtimedwait(&sigint, NULL, &now);
+    errno = EINTR;
+    return 1;
+}
+
+// Copies with one kernel-side call per chunk. Returns 1 when done, 0 if the
+// call is not supported for these descriptors before anything was copied
+// (the caller falls back), or -1 on an error.
+static int copy_in_kernel(int in_fd, int out_fd, int from_pipe) {
+    int copied = 0;
+    while (1) {
+        ssize_t sent = from_pipe ? splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MORE)
+                                 : sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+        if (sent > 0) {
+            copied = 1;
+            if (interrupted()) {
+                return -1;
+            }
+            continue;
+        }
+        if (sent == 0) {
+            return 1;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!copied && (errno == EINVAL || errno == ENOSYS)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+static int copy_blocks(int in_fd, int out_fd) {
+    char *buffer = malloc(COPY_BLOCK_SIZE);
+    if (buffer == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    int result = 0;
+    while (result == 0) {
+        if (interrupted()) {
+            result = -1;
+            break;
+        }
+        ssize_t got = read(in_fd, buffer, COPY_BLOCK_SIZE);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            result = (got < 0) ? -1 : 1;
+            break;
+        }
+        for (ssize_t done = 0; done < got;) {
+            ssize_t wrote = write(out_fd, buffer + done, got - done);
+            if (wrote < 0 && errno == EINTR) continue;
+            if (wrote < 0) {
+                result = -1;
+                break;
+            }
+            done += wrote;
+        }
+    }
+    int saved_errno = errno;
+    free(buffer);
+    errno = saved_errno;
+    return (result < 0) ? -1 : 0;
+}
+
+int copy_fd(int in_fd, int out_fd) {
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) {
+        return -1;
+    }
+    int result = 0;
+    if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+        result = copy_in_kernel(in_fd, out_fd, 0);
+    } else if (S_ISFIFO(st.st_mode)) {
+        result = copy_in_kernel(in_fd, out_fd, 1);
+    }
+    if (result != 0) {
+        return (result < 0) ? -1 : 0;
+    }
+    return copy_blocks(in_fd, out_fd);
+}
@@ -0,0 +1,14 @@
+#ifndef COPYFD_H
+#define COPYFD_H
+
+#define COPY_CHUNK (1 << 20)       // Most bytes asked of one sendfile/splice call
+#define COPY_BLOCK_SIZE (1 << 20)  // Buffer for the read/write fallback
+
+// Copies everything from in_fd, from its current offset, to out_fd. The data
+// stays in the kernel where it can: sendfile from a file, splice from a
+// pipe, and read/write in COPY_BLOCK_SIZE blocks when neither is supported
+// between the two (e.g. to a terminal). A pending Ctrl-C ends the copy with
+// errno set to EINTR. Returns 0, or -1 with errno set.
+int copy_fd(int in_fd, int out_fd);
+
+#endif // COPYFD_H
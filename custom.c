@@ -95,20 +95,27 @@ void load_functions(const char *myshrc_file) {
 
 
 
+// Check whether a function with this name was loaded from .myshrc
+int is_custom_function(const char *name) {
+    for (Function *func = function_list; func != NULL; func = func->next) {
+        if (strcmp(func->name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 // Execute a custom function if it matches
-int execute_custom_function(const char *command, char *home) {
-    char function_name[MAX_FUNCTION_NAME];
+int execute_custom_function(int argc, char **argv, char *home) {
+    const char *function_name = argv[0];
     char function_args[MAX_FUNCTION_BODY] = {0};
-    char *arg_start;
 
-    // Extract function name
-    sscanf(command, "%s", function_name);
-
-    // Extract arguments if present
-    arg_start = strchr(command, ' ');
-    if (arg_start) {
-        arg_start++;  // Move past the space
-        strcpy(function_args, arg_start);
+    // Join the arguments back together, separated by spaces
+    for (int i = 1; i < argc; i++) {
+        if (i > 1) {
+            strncat(function_args, " ", sizeof(function_args) - strlen(function_args) - 1);
+        }
+        strncat(function_args, argv[i], sizeof(function_args) - strlen(function_args) - 1);
     }
 
     // Search for the function in the function list
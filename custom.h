@@ -4,7 +4,10 @@
 // Loads the function definitions from the .myshrc file
 void load_functions(const char *myshrc_file);
 
+// Returns 1 if a function with this name was defined in the .myshrc file
+int is_custom_function(const char *name);
+
 // Executes the command if it matches a function defined in the .myshrc file
-int execute_custom_function(const char *command,char * home);
+int execute_custom_function(int argc, char **argv, char *home);
 
 #endif // CUSTOM_H
@@ -0,0 +1,580 @@
+#define _GNU_SOURCE  // P_PIDFD
+#include "events.h"
+#include "signal.h"
+#include "jobs.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define MAX_EVENTS 64          // Events handled per epoll_wait
+#define DESCRIPTOR_RESERVE 128  // Descriptors kept free for everything but pidfds
+
+typedef enum WatchKind {
+    WATCH_SIGNALS,        // The signalfd
+    WATCH_INPUT,          // stdin, while events_read_line waits for it
+    WATCH_CHILD,          // A pidfd; readable once the child has exited
+    WATCH_FD,             // A descriptor registered with events_watch_fd
+    WATCH_TIMER           // A timerfd registered with events_add_timer
+} WatchKind;
+
+// What an epoll event refers to (its data.ptr)
+typedef struct Watch {
+    WatchKind kind;
+    int fd;
+    pid_t pid;                 // For WATCH_CHILD
+    event_callback callback;   // For WATCH_FD and WATCH_TIMER
+    void *arg;
+    struct Watch *next;        // Next descriptor or timer watch, or next child watch
+} Watch;
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static Watch signal_watch = { WATCH_SIGNALS };
+static Watch input_watch = { WATCH_INPUT, STDIN_FILENO };
+static int input_ready;
+
+// Descriptors and timers, so that they can be found again to be removed
+static Watch *fd_watches;
+
+// Children followed through a pidfd, and the descriptor limit they count against
+static Watch *child_watches;
+static int num_watched;
+static rlim_t descriptor_limit;
+
+// Children pidfd_open could not follow (e.g. out of descriptors); they are
+// checked with waitpid on every SIGCHLD instead
+static pid_t *unwatched;
+static int num_unwatched;
+static int unwatched_capacity;
+
+// Children a foreground wait is blocked on, and where their statuses go
+static const pid_t *waited_pids;
+static int *waited_statuses;
+static int waited_count;
+static int waited_remaining;
+
+// Children that exited or stopped before anything waited for them, e.g. the
+// first stages of a pipeline while its last stage (a builtin such as
+// parallel) waits for children of its own
+static pid_t *early_pids;
+static int *early_statuses;
+static int num_early;
+static int early_capacity;
+
+// Input read so far; bytes after line_end belong to the next line
+static char *input;
+static size_t input_capacity;
+static size_t input_length;
+static size_t line_end;
+
+static void create_epoll_set(void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &signal_watch };
+    signal_watch.fd = signal_fd;
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1) {
+        perror(RED "Error creating epoll set" RESET);
+        exit(1);
+    }
+}
+
+void events_init(void) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTSTP);
+    sigaddset(&signals, SIGQUIT);
+
+    // Programs are started with an empty mask (see launch.c)
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1) {
+        perror(RED "Error blocking signals" RESET);
+        exit(1);
+    }
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror(RED "Error creating signalfd" RESET);
+        exit(1);
+    }
+
+    struct rlimit limit;
+    descriptor_limit = (getrlimit(RLIMIT_NOFILE, &limit) == 0) ? limit.rlim_cur : 1024;
+    create_epoll_set();
+}
+
+void events_after_fork(void) {
+    if (epoll_fd == -1) {
+        return;
+    }
+
+    // Ctrl-C and Ctrl-Z reach the child straight from the terminal, and it
+    // must react to them like any program. Only SIGCHLD is still read from
+    // a signalfd, for children without a pidfd. The parent's signalfd
+    // cannot be narrowed, since its mask is shared with the parent.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_SETMASK, &signals, NULL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    close(signal_fd);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror(RED "Error creating signalfd" RESET);
+        exit(1);
+    }
+
+    // The watches (and their memory) belong to the parent
+    close(epoll_fd);
+    fd_watches = NULL;
+    child_watches = NULL;
+    num_watched = 0;
+    num_unwatched = 0;
+    num_early = 0;
+    waited_count = 0;
+    create_epoll_set();
+}
+
+// Converts what waitid reports into a waitpid-style status
+static int wait_status(const siginfo_t *info) {
+    switch (info->si_code) {
+        case CLD_EXITED:    return (info->si_status & 0xff) << 8;
+        case CLD_KILLED:    return info->si_status;
+        case CLD_DUMPED:    return info->si_status | 0x80;
+        case CLD_STOPPED:
+        case CLD_TRAPPED:   return (info->si_status << 8) | 0x7f;
+        default:            return 0xffff;  // CLD_CONTINUED
+    }
+}
+
+static void remember_early(pid_t pid, int status) {
+    if (num_early == early_capacity) {
+        int capacity = (early_capacity == 0) ? 16 : early_capacity * 2;
+        pid_t *pids = realloc(early_pids, capacity * sizeof(pid_t));
+        if (pids != NULL) early_pids = pids;
+        int *statuses = realloc(early_statuses, capacity * sizeof(int));
+        if (statuses != NULL) early_statuses = statuses;
+        if (pids == NULL || statuses == NULL) {
+            perror(RED "realloc failed" RESET);
+            return;
+        }
+        early_capacity = capacity;
+    }
+    early_pids[num_early] = pid;
+    early_statuses[num_early++] = status;
+}
+
+// Records a change in a child's state: foreground children wake their waiter,
+// background jobs that stop or continue change state, and those that finished
+// are reported and dropped from the job list. Any other child is kept until
+// it is waited for.
+static void report_child(pid_t pid, int status) {
+    for (int i = 0; i < waited_count; i++) {
+        if (waited_pids[i] == pid && !WIFCONTINUED(status)) {
+            waited_statuses[i] = status;
+            waited_remaining--;
+            return;
+        }
+    }
+
+    Job *job = find_process(pid);
+    if (job == NULL) {
+        if (!WIFCONTINUED(status)) {
+            remember_early(pid, status);  // Someone waits for it later
+        }
+        return;
+    }
+    if (WIFSTOPPED(status)) {
+        job->state = JOB_STOPPED;  // e.g. by reading the terminal, or ping
+        return;
+    }
+    if (WIFCONTINUED(status)) {
+        job->state = JOB_RUNNING;
+        return;
+    }
+    if (WIFEXITED(status)) {
+        printf("Background process %d (%s) ended normally with exit status %d\n", pid, job->command, WEXITSTATUS(status));
+    } else {
+        printf("Background process %d (%s) ended abnormally with signal %d\n", pid, job->command, WTERMSIG(status));
+    }
+    remove_process(pid);
+}
+
+// Reaps a child whose pidfd became readable. Waiting on the pidfd rather
+// than the pid cannot reap some other process that reused the pid.
+static void reap_child(Watch *watch) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PIDFD, watch->fd, &info, WEXITED | WNOHANG) == 0 && info.si_pid == 0) {
+        return;  // Not finished after all
+    }
+    for (Watch **link = &child_watches; *link != NULL; link = &(*link)->next) {
+        if (*link == watch) {
+            *link = watch->next;
+            break;
+        }
+    }
+    close(watch->fd);  // Also removes it from the epoll set
+    num_watched--;
+    if (info.si_pid != 0) {
+        report_child(watch->pid, wait_status(&info));
+    }
+    free(watch);
+}
+
+// SIGCHLD is not queued, so one notification may stand for many children.
+// Exits arrive through pidfds; only stops and continues are collected here.
+static void collect_child_changes(void) {
+    siginfo_t info;
+    while (1) {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) != 0 || info.si_pid == 0) {
+            break;
+        }
+        report_child(info.si_pid, wait_status(&info));
+    }
+
+    for (int i = 0; i < num_unwatched; i++) {
+        int status;
+        if (waitpid(unwatched[i], &status, WNOHANG) > 0) {
+            pid_t pid = unwatched[i];
+            unwatched[i--] = unwatched[--num_unwatched];
+            report_child(pid, status);
+        }
+    }
+}
+
+static void handle_signal_events(void) {
+    struct signalfd_siginfo info[32];
+    ssize_t got;
+    while ((got = read(signal_fd, info, sizeof(info))) > 0) {
+        int children = 0;
+        for (size_t i = 0; i < got / sizeof(info[0]); i++) {
+            switch (info[i].ssi_signo) {
+                case SIGCHLD:
+                    children = 1;
+                    break;
+                case SIGINT:
+                    handle_sigint(SIGINT);
+                    break;
+                case SIGTSTP:
+                    handle_sigtstp(SIGTSTP);
+                    break;
+                case SIGQUIT:
+                    handle_sigquit(SIGQUIT);
+                    break;
+            }
+        }
+        if (children) {
+            collect_child_changes();
+        }
+    }
+}
+
+// Waits up to timeout milliseconds (-1 for ever) and handles what is ready.
+// Callbacks may remove their own watch, but not other ones.
+static void dispatch(int timeout) {
+    struct epoll_event events[MAX_EVENTS];
+    fflush(stdout);
+    int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+    if (ready < 0 && errno != EINTR) {
+        perror(RED "epoll_wait failed" RESET);
+    }
+
+    for (int i = 0; i < ready; i++) {
+        Watch *watch = events[i].data.ptr;
+        switch (watch->kind) {
+            case WATCH_SIGNALS:
+                handle_signal_events();
+                break;
+            case WATCH_INPUT:
+                input_ready = 1;
+                break;
+            case WATCH_CHILD:
+                reap_child(watch);
+                break;
+            case WATCH_TIMER: {
+                uint64_t expirations;
+                if (read(watch->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                    break;
+                }
+                watch->callback(watch->arg);
+                break;
+            }
+            case WATCH_FD:
+                watch->callback(watch->arg);
+                break;
+        }
+    }
+}
+
+void events_poll(void) {
+    dispatch(0);
+}
+
+void events_run_until(const int *done) {
+    while (!*done) {
+        dispatch(-1);
+    }
+}
+
+// Every job holds a pidfd, so thousands of jobs need more than the usual
+// 1024 descriptors. The limit is only raised once the pidfds come close to
+// it, since programs started afterwards inherit it.
+static void reserve_descriptors(void) {
+    if (num_watched + DESCRIPTOR_RESERVE < descriptor_limit) {
+        return;
+    }
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            descriptor_limit = limit.rlim_cur;
+        }
+    }
+}
+
+void events_watch_child(pid_t pid) {
+    reserve_descriptors();
+    int fd = (num_watched + DESCRIPTOR_RESERVE / 2 < descriptor_limit)
+           ? syscall(SYS_pidfd_open, pid, 0)  // Close-on-exec by default
+           : -1;
+    Watch *watch = (fd >= 0) ? malloc(sizeof(Watch)) : NULL;
+    if (watch != NULL) {
+        *watch = (Watch){ WATCH_CHILD, fd, pid, NULL, NULL, child_watches };
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = watch };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) {
+            child_watches = watch;
+            num_watched++;
+            return;
+        }
+        free(watch);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // Fall back to polling it with waitpid
+    if (num_unwatched == unwatched_capacity) {
+        int capacity = (unwatched_capacity == 0) ? 16 : unwatched_capacity * 2;
+        pid_t *grown = realloc(unwatched, capacity * sizeof(pid_t));
+        if (grown == NULL) {
+            perror(RED "realloc failed" RESET);
+            return;
+        }
+        unwatched = grown;
+        unwatched_capacity = capacity;
+    }
+    unwatched[num_unwatched++] = pid;
+}
+
+// Whether an exit or stop of pid can still be reported: it is a child that
+// is watched, polled, or already finished without being waited for
+static int is_followed(pid_t pid) {
+    for (const Watch *watch = child_watches; watch != NULL; watch = watch->next) {
+        if (watch->pid == pid) return 1;
+    }
+    for (int i = 0; i < num_unwatched; i++) {
+        if (unwatched[i] == pid) return 1;
+    }
+    for (int i = 0; i < num_early; i++) {
+        if (early_pids[i] == pid) return 1;
+    }
+    return 0;
+}
+
+// Handles events until no more than remaining of the count children are
+// still to exit or stop. Returns how many did. A pid nothing is known about
+// (not a child of this shell, or reaped already) would never report, so it
+// is not waited for and counts as having exited with status 255.
+static int wait_for_children(const pid_t *pids, int count, int *statuses, int remaining) {
+    waited_pids = pids;
+    waited_statuses = statuses;
+    waited_count = count;
+    waited_remaining = count;
+    for (int j = 0; j < count; j++) {
+        if (!is_followed(pids[j])) {
+            fprintf(stderr, RED "Not a child of this shell: %d\n" RESET, pids[j]);
+            statuses[j] = W_EXITCODE(255, 0);
+            waited_remaining--;
+        }
+    }
+
+    for (int i = 0; i < num_early; i++) {
+        for (int j = 0; j < count; j++) {
+            if (pids[j] == early_pids[i]) {
+                statuses[j] = early_statuses[i];
+                waited_remaining--;
+                num_early--;
+                early_pids[i] = early_pids[num_early];
+                early_statuses[i] = early_statuses[num_early];
+                i--;
+                break;
+            }
+        }
+    }
+
+    // An exit keeps the pidfd readable until the child is reaped, and a
+    // stop leaves SIGCHLD pending, so nothing that already happened is missed
+    while (waited_remaining > remaining) {
+        dispatch(-1);
+    }
+    waited_count = 0;
+    return count - waited_remaining;
+}
+
+void events_wait_children(const pid_t *pids, int count, int *statuses) {
+    wait_for_children(pids, count, statuses, 0);
+}
+
+int events_wait_any(const pid_t *pids, int count, int *statuses) {
+    return wait_for_children(pids, count, statuses, count - 1);
+}
+
+static int add_watch(WatchKind kind, int fd, event_callback callback, void *arg) {
+    Watch *watch = malloc(sizeof(Watch));
+    if (watch == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    *watch = (Watch){ kind, fd, 0, callback, arg, fd_watches };
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = watch };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        free(watch);
+        return -1;
+    }
+    fd_watches = watch;
+    return 0;
+}
+
+static void remove_watch(int fd) {
+    for (Watch **link = &fd_watches; *link != NULL; link = &(*link)->next) {
+        if ((*link)->fd == fd) {
+            Watch *watch = *link;
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            *link = watch->next;
+            free(watch);
+            return;
+        }
+    }
+}
+
+int events_watch_fd(int fd, event_callback callback, void *arg) {
+    return add_watch(WATCH_FD, fd, callback, arg);
+}
+
+void events_unwatch_fd(int fd) {
+    remove_watch(fd);
+}
+
+int events_add_timer(int interval_ms, event_callback callback, void *arg) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        perror(RED "timerfd_create failed" RESET);
+        return -1;
+    }
+    struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    struct itimerspec spec = { interval, interval };
+    if (timerfd_settime(fd, 0, &spec, NULL) == -1 || add_watch(WATCH_TIMER, fd, callback, arg) == -1) {
+        perror(RED "Error starting timer" RESET);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void events_remove_timer(int id) {
+    remove_watch(id);
+    close(id);
+}
+
+// Reads whatever input is available into the buffer, waiting for it (and
+// handling events) if stdin can be watched. Returns what read(2) returned.
+static ssize_t read_input(int watching) {
+    if (watching) {
+        input_ready = 0;
+        while (!input_ready) {
+            dispatch(-1);
+        }
+    } else {
+        dispatch(0);  // Regular files are always readable
+    }
+
+    if (input_capacity - input_length < 4096) {
+        input_capacity = (input_capacity == 0) ? 8192 : input_capacity * 2;
+        input = realloc(input, input_capacity);
+        if (input == NULL) {
+            perror(RED "realloc failed" RESET);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Leave one byte for the terminator of a last line with no newline
+    return read(STDIN_FILENO, input + input_length, input_capacity - input_length - 1);
+}
+
+// The input is read with read(2) rather than stdio, whose buffering would
+// hide lines that have already arrived from epoll
+char *events_read_line(void) {
+    // Drop the line returned last time
+    if (line_end > 0) {
+        memmove(input, input + line_end, input_length - line_end);
+        input_length -= line_end;
+        line_end = 0;
+    }
+
+    // stdin is only in the epoll set while a line is awaited, so that typing
+    // ahead does not keep waking the shell while it waits for a command
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &input_watch };
+    int watching = (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0);
+
+    char *line = NULL;
+    int at_eof = 0;
+    while (1) {
+        char *newline = memchr(input, '\n', input_length);
+        if (newline != NULL || (at_eof && input_length > 0)) {
+            size_t length = (newline != NULL) ? (size_t)(newline - input) : input_length;
+            if (newline == NULL) {
+                input[input_length++] = '\0';  // Room was left by the last read
+            }
+            input[length] = '\0';
+            line_end = length + 1;
+            line = input;
+            break;
+        }
+        if (at_eof) {
+            break;
+        }
+
+        ssize_t got = read_input(watching);
+        if (got < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror(RED "Error reading input" RESET);
+            exit(EXIT_FAILURE);
+        }
+        if (got == 0) {
+            at_eof = 1;
+        }
+        input_length += got;
+    }
+
+    if (watching) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+    }
+    return line;
+}
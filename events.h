@@ -0,0 +1,56 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <sys/types.h>
+
+typedef void (*event_callback)(void *arg);
+
+// Blocks SIGCHLD, SIGINT, SIGTSTP and SIGQUIT and receives them through a
+// signalfd instead, so that they are only ever handled from the event loop
+// and never interrupt the shell halfway through updating its job list.
+// Everything the shell waits for is multiplexed in one epoll set.
+void events_init(void);
+
+// Gives a forked child that keeps running shell code its own epoll set.
+// The set is shared with the parent across fork, and the child's events
+// must not be mixed with the parent's. The child also gets back the
+// default handling of SIGINT, SIGTSTP, SIGQUIT and SIGPIPE.
+void events_after_fork(void);
+
+// Waits for a line of input while handling job events. Returns the line
+// without its newline (valid until the next call), or NULL at end of input.
+char *events_read_line(void);
+
+// Handles the signals and child events that are already pending, without
+// waiting for more
+void events_poll(void);
+
+// Handles events until *done becomes non-zero (set by a callback)
+void events_run_until(const int *done);
+
+// Starts following a child the shell created. Its exit is seen through a
+// pidfd, so it is reaped exactly once and never confused with a later
+// process that reuses its pid. Every child must be watched before it is
+// waited for.
+void events_watch_child(pid_t pid);
+
+// Waits until each of the count watched children in pids has exited or
+// stopped, handling every other event meanwhile, and stores their wait statuses.
+void events_wait_children(const pid_t *pids, int count, int *statuses);
+
+// Like events_wait_children, but returns as soon as at least one of them has
+// exited or stopped. Only the statuses of those children are stored (the
+// others are left as they were); returns how many there were.
+int events_wait_any(const pid_t *pids, int count, int *statuses);
+
+// Calls callback whenever fd is readable, until events_unwatch_fd(fd).
+// Returns -1 if fd cannot be watched (e.g. a regular file).
+int events_watch_fd(int fd, event_callback callback, void *arg);
+void events_unwatch_fd(int fd);
+
+// Calls callback every interval_ms milliseconds. Returns an id for
+// events_remove_timer, or -1 on failure.
+int events_add_timer(int interval_ms, event_callback callback, void *arg);
+void events_remove_timer(int id);
+
+#endif // EVENTS_H
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE  // tee, splice
+#include "fanout.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define FANOUT_CHUNK 65536  // Most bytes handled per round: one default pipe buffer
+
+// Only used when a consumer accepted part of a round or tee(2) is unsupported
+static char buffer[FANOUT_CHUNK];
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Reads exactly length bytes that are known to be waiting in the pipe
+static int read_all(int fd, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t got = read(fd, data, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        data += got;
+        length -= got;
+    }
+    return 0;
+}
+
+// Marks an output as gone. A reader that exits early is normal (e.g. head),
+// anything else is reported.
+static void drop_output(int *fds, int i, int *alive) {
+    if (errno != EPIPE) {
+        perror(RED "Fan-out write failed" RESET);
+    }
+    fds[i] = -1;
+    (*alive)--;
+}
+
+// Copies one round with read/write. Returns the bytes copied, 0 at end-of-file.
+static ssize_t buffered_round(int in_fd, int *fds, int num_outputs, int *alive) {
+    ssize_t got;
+    do {
+        got = read(in_fd, buffer, sizeof(buffer));
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) return got;
+
+    for (int i = 0; i < num_outputs; i++) {
+        if (fds[i] >= 0 && write_all(fds[i], buffer, got) != 0) {
+            drop_output(fds, i, alive);
+        }
+    }
+    return got;
+}
+
+// Duplicates the data waiting in in_fd to every live output but the last with
+// tee(2), then moves it to the last one with splice(2), which also consumes it.
+// Returns the bytes copied, 0 at end-of-file, -1 with errno set on an error
+// (EINVAL if the descriptors do not support tee).
+static ssize_t zero_copy_round(int in_fd, int *fds, int *teed, int num_outputs, int *alive) {
+    int last = num_outputs - 1;
+    while (fds[last] < 0) last--;
+
+    ssize_t chunk = -1;
+    int short_tee = 0;
+    for (int i = 0; i < last; i++) {
+        if (fds[i] < 0) continue;
+        // The first tee decides how much this round copies
+        ssize_t t = tee(in_fd, fds[i], chunk < 0 ? FANOUT_CHUNK : (size_t)chunk, 0);
+        if (t < 0 && errno == EINTR) {
+            i--;
+            continue;
+        }
+        if (t < 0 && errno == EINVAL && chunk < 0) return -1;
+        if (t < 0) {
+            drop_output(fds, i, alive);
+            continue;
+        }
+        if (chunk < 0) {
+            if (t == 0) return 0;
+            chunk = t;
+        }
+        teed[i] = t;
+        short_tee |= (t < chunk);
+    }
+
+    if (chunk < 0) {
+        // Only one consumer is left, so the data can simply be moved
+        ssize_t moved;
+        do {
+            moved = splice(in_fd, NULL, fds[last], NULL, FANOUT_CHUNK, SPLICE_F_MOVE);
+        } while (moved < 0 && errno == EINTR);
+        if (moved < 0 && errno == EINVAL) return -1;
+        if (moved < 0) {
+            drop_output(fds, last, alive);
+            return 1;  // Not end-of-file, but no consumer is left either
+        }
+        return moved;
+    }
+
+    if (!short_tee) {
+        size_t remaining = chunk;
+        while (remaining > 0) {
+            ssize_t moved = splice(in_fd, NULL, fds[last], NULL, remaining, SPLICE_F_MOVE);
+            if (moved < 0 && errno == EINTR) continue;
+            if (moved <= 0) {
+                drop_output(fds, last, alive);
+                break;
+            }
+            remaining -= moved;
+        }
+        if (remaining == 0) return chunk;
+        // The last reader went away: consume the rest of the round by hand
+        return read_all(in_fd, buffer, remaining) == 0 ? chunk : -1;
+    }
+
+    // A tee came back short (its consumer's pipe was full). tee always starts
+    // at the head of the pipe, so the missing tails are written from a copy.
+    if (read_all(in_fd, buffer, chunk) != 0) return -1;
+    for (int i = 0; i < last; i++) {
+        if (fds[i] >= 0 && teed[i] < chunk &&
+            write_all(fds[i], buffer + teed[i], chunk - teed[i]) != 0) {
+            drop_output(fds, i, alive);
+        }
+    }
+    if (write_all(fds[last], buffer, chunk) != 0) {
+        drop_output(fds, last, alive);
+    }
+    return chunk;
+}
+
+int fanout_copy(int in_fd, const int *out_fds, int num_outputs) {
+    int *fds = malloc(2 * num_outputs * sizeof(int));
+    if (fds == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    int *teed = fds + num_outputs;
+    memcpy(fds, out_fds, num_outputs * sizeof(int));
+
+    // Consumers that exit early must not take the shell down with them
+    void (*saved_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    int alive = num_outputs;
+    int zero_copy = 1;
+    int status = 0;
+    while (alive > 0) {
+        ssize_t copied;
+        if (zero_copy) {
+            copied = zero_copy_round(in_fd, fds, teed, num_outputs, &alive);
+            if (copied < 0 && errno == EINVAL) {
+                zero_copy = 0;  // Not a pipe: fall back to read/write
+                continue;
+            }
+        } else {
+            copied = buffered_round(in_fd, fds, num_outputs, &alive);
+        }
+        if (copied < 0) {
+            perror(RED "Fan-out read failed" RESET);
+            status = -1;
+            break;
+        }
+        if (copied == 0) break;
+    }
+
+    signal(SIGPIPE, saved_sigpipe);
+    free(fds);
+    return status;
+}
@@ -0,0 +1,11 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+// Copies everything from the pipe in_fd to each of the num_outputs pipes in
+// out_fds until in_fd reaches end-of-file or every output has been closed by
+// its reader. Data is duplicated with tee(2) and moved with splice(2), so it
+// never passes through user space unless a tee comes back short.
+// Returns 0 on success, -1 on a read error.
+int fanout_copy(int in_fd, const int *out_fds, int num_outputs);
+
+#endif // FANOUT_H
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE  // memmem, memrchr
+#include "filescan.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int append(ScanOutput *out, const char *text, size_t length) {
+    if (out->length + length > out->capacity) {
+        size_t capacity = (out->capacity == 0) ? 4096 : out->capacity;
+        while (capacity < out->length + length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(out->data, capacity);
+        if (grown == NULL) {
+            perror(RED "realloc failed" RESET);
+            return -1;
+        }
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+    return 0;
+}
+
+// Counts the newlines in [from, to), to number the lines
+static size_t count_lines(const char *from, const char *to) {
+    size_t count = 0;
+    while ((from = memchr(from, '\n', to - from)) != NULL) {
+        count++;
+        from++;
+    }
+    return count;
+}
+
+// Finds the matches with memmem and only then looks for the lines around
+// them, so the text between matches is only scanned for newlines once.
+// *line is the number of the first line of data, and is moved past its end.
+static size_t scan_text(const char *data, size_t size, const char *pattern, size_t pattern_length,
+                        const char *prefix, ScanOutput *out, size_t *line_number) {
+    const char *end = data + size;
+    const char *counted = data;  // Lines before this are numbered
+    size_t line = *line_number;
+    size_t found = 0;
+    const char *position = data;
+    const char *match;
+    while (position < end && (match = memmem(position, end - position, pattern, pattern_length)) != NULL) {
+        const char *line_start = memrchr(data, '\n', match - data);
+        line_start = (line_start != NULL) ? line_start + 1 : data;
+        const char *line_end = memchr(match, '\n', end - match);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        line += count_lines(counted, line_start);
+        counted = line_start;
+
+        char number[32];
+        int number_length = snprintf(number, sizeof(number), ":%zu:", line);
+        if (append(out, prefix, strlen(prefix)) != 0 || append(out, number, number_length) != 0 ||
+            append(out, line_start, line_end - line_start) != 0 || append(out, "\n", 1) != 0) {
+            break;
+        }
+        found++;
+        position = line_end + 1;  // One report per line
+    }
+    *line_number = line + count_lines(counted, end);
+    return found;
+}
+
+size_t scan_file(FileScanner *scanner, int dir_fd, const char *name, const char *pattern, size_t pattern_length,
+                 const char *prefix, ScanOutput *out) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    if (scanner->buffer == NULL) {
+        if ((scanner->buffer = malloc(SCAN_BLOCK_SIZE)) == NULL) {
+            perror(RED "malloc failed" RESET);
+            close(fd);
+            return 0;
+        }
+        scanner->capacity = SCAN_BLOCK_SIZE;
+    }
+
+    // The file is read a block at a time rather than mapped: a mapped file
+    // that is truncated meanwhile (a rotated log) would kill the shell with
+    // SIGBUS. The last, partial line of a block is kept for the next one.
+    size_t found = 0;
+    size_t line = 1;
+    size_t kept = 0;
+    off_t offset = 0;
+    while (1) {
+        if (kept == scanner->capacity) {
+            char *grown = realloc(scanner->buffer, 2 * scanner->capacity);
+            if (grown == NULL) {
+                perror(RED "realloc failed" RESET);
+                break;
+            }
+            scanner->buffer = grown;
+            scanner->capacity *= 2;  // A line longer than the buffer
+        }
+        ssize_t got = pread(fd, scanner->buffer + kept, scanner->capacity - kept, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            // Shorter than it was (or unreadable): what is left ends the file
+            found += scan_text(scanner->buffer, kept, pattern, pattern_length, prefix, out, &line);
+            break;
+        }
+        size_t size = kept + got;
+        if (offset == 0 &&
+            memchr(scanner->buffer, '\0', size < SCAN_BINARY_PROBE ? size : SCAN_BINARY_PROBE) != NULL) {
+            break;
+        }
+        offset += got;
+        if (offset >= st.st_size) {
+            found += scan_text(scanner->buffer, size, pattern, pattern_length, prefix, out, &line);
+            break;
+        }
+
+        const char *last_newline = memrchr(scanner->buffer, '\n', size);
+        size_t complete = (last_newline != NULL) ? (size_t)(last_newline - scanner->buffer) + 1 : 0;
+        found += scan_text(scanner->buffer, complete, pattern, pattern_length, prefix, out, &line);
+        kept = size - complete;
+        memmove(scanner->buffer, scanner->buffer + complete, kept);
+    }
+    close(fd);
+    return found;
+}
+
+void file_scanner_clear(FileScanner *scanner) {
+    free(scanner->buffer);
+    scanner->buffer = NULL;
+    scanner->capacity = 0;
+}
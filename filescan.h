@@ -0,0 +1,29 @@
+#ifndef FILESCAN_H
+#define FILESCAN_H
+
+#include <stddef.h>
+
+#define SCAN_BLOCK_SIZE 262144 // Bytes read at a time; longer lines make the buffer grow
+#define SCAN_BINARY_PROBE 8192 // A NUL byte this close to the start marks a binary file
+
+// State of one scanning thread: the buffer files are read into
+typedef struct FileScanner {
+    char *buffer;
+    size_t capacity;
+} FileScanner;
+
+// Lines that matched, as "prefix:line:text\n"
+typedef struct ScanOutput {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ScanOutput;
+
+// Appends every line of the file (name, relative to dir_fd) that contains
+// pattern to out. Binary files are skipped. Returns the number of lines.
+size_t scan_file(FileScanner *scanner, int dir_fd, const char *name, const char *pattern, size_t pattern_length,
+                 const char *prefix, ScanOutput *out);
+
+void file_scanner_clear(FileScanner *scanner);
+
+#endif // FILESCAN_H
@@ -0,0 +1,153 @@
+#include "histsearch.h"
+#include "log.h"
+#include "events.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+
+#define QUERY_MAX 256
+
+#define KEY_CTRL_C 3
+#define KEY_CTRL_G 7
+#define KEY_BACKSPACE 8
+#define KEY_CTRL_R 18
+#define KEY_ESCAPE 27
+#define KEY_DELETE 127
+
+typedef struct SearchState {
+    char query[QUERY_MAX];
+    size_t query_length;
+    int skip;             // Matches to pass over: how often Ctrl-R was pressed
+    char *match;          // The match shown, or NULL
+    int done;             // 1 once accepted, -1 once cancelled
+} SearchState;
+
+// Search callback: stops at the skip-th match and keeps a copy of it
+static int take_match(int index, const char *command, size_t length, void *arg) {
+    SearchState *state = arg;
+    if (state->skip-- > 0) {
+        return 0;
+    }
+    state->match = strndup(command, length);
+    return 1;
+}
+
+static void find_match(SearchState *state) {
+    free(state->match);
+    state->match = NULL;
+    int skip = state->skip;
+    log_search(state->query, take_match, state);
+    state->skip = skip;
+}
+
+static void show(const SearchState *state) {
+    printf("\r\033[K(reverse-i-search)`%s': %s", state->query, state->match ? state->match : "");
+    fflush(stdout);
+}
+
+static void handle_key(SearchState *state, unsigned char key) {
+    switch (key) {
+        case '\r':
+        case '\n':
+            state->done = 1;
+            return;
+        case KEY_CTRL_C:
+        case KEY_CTRL_G:
+        case KEY_ESCAPE:
+            state->done = -1;
+            return;
+        case KEY_CTRL_R: {
+            // Stay on the oldest match once there are no more
+            state->skip++;
+            char *previous = state->match;
+            state->match = NULL;
+            find_match(state);
+            if (state->match == NULL) {
+                state->skip--;
+                state->match = previous;
+            } else {
+                free(previous);
+            }
+            return;
+        }
+        case KEY_BACKSPACE:
+        case KEY_DELETE:
+            if (state->query_length > 0) {
+                state->query[--state->query_length] = '\0';
+            }
+            break;
+        default:
+            if (key < ' ' || state->query_length + 1 >= QUERY_MAX) {
+                return;
+            }
+            state->query[state->query_length++] = key;
+            state->query[state->query_length] = '\0';
+            break;
+    }
+    state->skip = 0;
+    find_match(state);
+}
+
+// Input callback: handles every key that is waiting
+static void read_keys(void *arg) {
+    SearchState *state = arg;
+    unsigned char keys[64];
+    ssize_t got = read(STDIN_FILENO, keys, sizeof(keys));
+    if (got <= 0) {
+        state->done = -1;  // End of input
+        return;
+    }
+    for (ssize_t i = 0; i < got && !state->done; i++) {
+        handle_key(state, keys[i]);
+    }
+    if (!state->done) {
+        show(state);
+    }
+}
+
+char *history_search_interactive(const char *initial) {
+    SearchState state = { "", 0, 0, NULL, 0 };
+    if (initial != NULL) {
+        strncpy(state.query, initial, QUERY_MAX - 1);
+        state.query_length = strlen(state.query);
+    }
+
+    // Keys are read one at a time, without echo; Ctrl-C arrives as a key
+    struct termios original, raw;
+    int is_terminal = (tcgetattr(STDIN_FILENO, &original) == 0);
+    if (is_terminal) {
+        raw = original;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+            perror(RED "Failed to set raw mode" RESET);
+            return NULL;
+        }
+    }
+
+    find_match(&state);
+    show(&state);
+    if (events_watch_fd(STDIN_FILENO, read_keys, &state) == 0) {
+        events_run_until(&state.done);
+        events_unwatch_fd(STDIN_FILENO);
+    } else {
+        // stdin is a regular file: read it directly
+        while (!state.done) {
+            read_keys(&state);
+        }
+    }
+    printf("\n");
+
+    if (is_terminal && tcsetattr(STDIN_FILENO, TCSAFLUSH, &original) == -1) {
+        perror(RED "Failed to restore terminal settings" RESET);
+    }
+    if (state.done < 0) {
+        free(state.match);
+        return NULL;
+    }
+    return state.match;
+}
@@ -0,0 +1,10 @@
+#ifndef HISTSEARCH_H
+#define HISTSEARCH_H
+
+// Ctrl-R style search of the history: the newest command containing what has
+// been typed so far is shown after every key. Ctrl-R steps to older matches,
+// Enter accepts and Ctrl-C, Ctrl-G or Escape cancel.
+// Returns the accepted command (malloc'd), or NULL if the search was cancelled.
+char *history_search_interactive(const char *initial);
+
+#endif // HISTSEARCH_H
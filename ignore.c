@@ -0,0 +1,165 @@
+#include "ignore.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <unistd.h>
+
+// Parses one line of an ignore file into rule. Returns 0 if it holds no rule.
+// This is the common part of the .gitignore syntax: comments, "!" to negate,
+// a trailing "/" for directories only, a "/" elsewhere to anchor the pattern
+// to the file's directory, a leading "**/" for any depth and a trailing "/**"
+// for everything inside a directory.
+static int parse_rule(char *line, IgnoreRule *rule) {
+    size_t length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        line[--length] = '\0';
+    }
+    if (length == 0 || line[0] == '#') {
+        return 0;
+    }
+    memset(rule, 0, sizeof(*rule));
+    if (line[0] == '!') {
+        rule->negate = 1;
+        line++;
+    } else if (line[0] == '\\' && (line[1] == '#' || line[1] == '!')) {
+        line++;
+    }
+    length = strlen(line);
+    if (length >= 3 && strcmp(line + length - 3, "/**") == 0) {
+        line[length -= 3] = '\0';
+        rule->dir_only = 1;  // The directory goes, and everything in it with it
+    }
+    if (length > 0 && line[length - 1] == '/') {
+        line[--length] = '\0';
+        rule->dir_only = 1;
+    }
+    while (strncmp(line, "**/", 3) == 0) {
+        line += 3;
+    }
+    if (line[0] == '/') {
+        line++;
+        rule->anchored = 1;
+    }
+    if (strchr(line, '/') != NULL) {
+        rule->anchored = 1;
+    }
+    if (line[0] == '\0') {
+        return 0;
+    }
+    rule->pattern = strdup(line);
+    return rule->pattern != NULL;
+}
+
+// Adds the rules of the ignore file name in dir_fd, if there is one
+static void load_file(IgnoreRules *rules, int dir_fd, const char *name) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    char *text = malloc(IGNORE_FILE_MAX + 1);
+    ssize_t length = (text != NULL) ? read(fd, text, IGNORE_FILE_MAX) : -1;
+    close(fd);
+    if (length <= 0) {
+        free(text);
+        return;
+    }
+    text[length] = '\0';
+
+    char *save;
+    for (char *line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        IgnoreRule rule;
+        if (!parse_rule(line, &rule)) {
+            continue;
+        }
+        IgnoreRule *grown = realloc(rules->rules, (rules->count + 1) * sizeof(IgnoreRule));
+        if (grown == NULL) {
+            perror(RED "realloc failed" RESET);
+            free(rule.pattern);
+            break;
+        }
+        rules->rules = grown;
+        rules->rules[rules->count++] = rule;
+    }
+    free(text);
+}
+
+IgnoreRules *ignore_enter(IgnoreRules *parent, int dir_fd, const char *dir, int flags) {
+    IgnoreRules *rules = calloc(1, sizeof(IgnoreRules));
+    if (rules == NULL) {
+        perror(RED "malloc failed" RESET);
+    } else {
+        // Later rules win, so .seekignore can override .gitignore
+        if (flags & IGNORE_GIT) {
+            load_file(rules, dir_fd, ".gitignore");
+        }
+        if (flags & IGNORE_SEEK) {
+            load_file(rules, dir_fd, ".seekignore");
+        }
+    }
+    if (rules == NULL || rules->count == 0 || (rules->dir = strdup(dir)) == NULL) {
+        free(rules);
+        return ignore_retain(parent);
+    }
+    rules->parent = ignore_retain(parent);
+    rules->refs = 1;
+    return rules;
+}
+
+static int rule_matches(const IgnoreRule *rule, const char *path, const char *name, int is_dir) {
+    if (rule->dir_only && !is_dir) {
+        return 0;
+    }
+    if (rule->anchored) {
+        return fnmatch(rule->pattern, path, FNM_PATHNAME) == 0;
+    }
+    return fnmatch(rule->pattern, name, 0) == 0;
+}
+
+int ignore_check(const IgnoreRules *rules, const char *dir, const char *name, int is_dir, int flags) {
+    if ((flags & IGNORE_GIT) && is_dir && strcmp(name, ".git") == 0) {
+        return 1;
+    }
+    if (rules == NULL) {
+        return 0;
+    }
+
+    // The path of the entry from the root, for anchored rules
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s%s", dir, dir[0] ? "/" : "", name);
+
+    // The deepest file decides first, and within a file the last matching rule
+    for (const IgnoreRules *level = rules; level != NULL; level = level->parent) {
+        size_t prefix = strlen(level->dir);
+        const char *relative = path + prefix + (prefix > 0 ? 1 : 0);
+        for (int i = level->count - 1; i >= 0; i--) {
+            if (rule_matches(&level->rules[i], relative, name, is_dir)) {
+                return !level->rules[i].negate;
+            }
+        }
+    }
+    return 0;
+}
+
+IgnoreRules *ignore_retain(IgnoreRules *rules) {
+    if (rules != NULL) {
+        __atomic_add_fetch(&rules->refs, 1, __ATOMIC_RELAXED);
+    }
+    return rules;
+}
+
+void ignore_release(IgnoreRules *rules) {
+    while (rules != NULL && __atomic_sub_fetch(&rules->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        IgnoreRules *parent = rules->parent;
+        for (int i = 0; i < rules->count; i++) {
+            free(rules->rules[i].pattern);
+        }
+        free(rules->rules);
+        free(rules->dir);
+        free(rules);
+        rules = parent;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#define IGNORE_SEEK 1          // Read .seekignore files
+#define IGNORE_GIT 2           // Also read .gitignore files and skip .git directories
+#define IGNORE_FILE_MAX (1 << 20)  // Larger ignore files are not read
+
+typedef struct IgnoreRule {
+    char *pattern;
+    int negate;                // "!pattern": not ignored after all
+    int dir_only;              // "pattern/": only matches directories
+    int anchored;              // Contains a '/': matched against the path from the file's directory
+} IgnoreRule;
+
+// The rules of one directory's ignore files, linked to those of the
+// directories above it. Shared by every directory below, across threads.
+typedef struct IgnoreRules {
+    struct IgnoreRules *parent;
+    char *dir;                 // Path of the directory, relative to the root of the walk
+    IgnoreRule *rules;
+    int count;
+    int refs;                  // Updated atomically
+} IgnoreRules;
+
+// Returns the rules that apply below the directory dir_fd (at dir, relative
+// to the root): parent plus what its own ignore files add. The result holds
+// a reference; it is NULL if there are no rules at all.
+IgnoreRules *ignore_enter(IgnoreRules *parent, int dir_fd, const char *dir, int flags);
+
+// Whether the entry name in directory dir (relative to the root) is ignored
+int ignore_check(const IgnoreRules *rules, const char *dir, const char *name, int is_dir, int flags);
+
+// Takes another reference to rules (which may be NULL)
+IgnoreRules *ignore_retain(IgnoreRules *rules);
+void ignore_release(IgnoreRules *rules);
+
+#endif // IGNORE_H
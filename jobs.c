@@ -0,0 +1,276 @@
+#include "jobs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "color.h"
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Job n lives in jobs[n - 1], so job numbers double as slot indices
+static Job *jobs = NULL;
+static int jobs_capacity = 0;
+static int next_job_id = 1;      // Lowest job number never handed out
+
+// Numbers of removed jobs, as a min-heap so the lowest is reused first
+static int *free_ids = NULL;
+static int num_free_ids = 0;
+
+// pid -> job number, open addressing with linear probing; 0 marks an empty slot
+static int *pid_slots = NULL;
+static unsigned pid_table_size = 0;
+
+// Job numbers sorted by command name and then pid, for activities
+static int *order = NULL;
+static int num_jobs = 0;
+
+static unsigned pid_hash(pid_t pid) {
+    return ((uint32_t)pid * 2654435761u) & (pid_table_size - 1);
+}
+
+// Returns the pid table slot holding pid, or the empty slot where it would go
+static unsigned pid_slot(pid_t pid) {
+    unsigned i = pid_hash(pid);
+    while (pid_slots[i] != 0 && jobs[pid_slots[i] - 1].pid != pid) {
+        i = (i + 1) & (pid_table_size - 1);
+    }
+    return i;
+}
+
+// Doubles the pid table, keeping it at most half full
+static int grow_pid_table(void) {
+    unsigned old_size = pid_table_size;
+    int *old_slots = pid_slots;
+    unsigned new_size = (old_size == 0) ? 64 : old_size * 2;
+    int *new_slots = calloc(new_size, sizeof(int));
+    if (new_slots == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+
+    pid_slots = new_slots;
+    pid_table_size = new_size;
+    for (unsigned i = 0; i < old_size; i++) {
+        if (old_slots[i] != 0) {
+            pid_slots[pid_slot(jobs[old_slots[i] - 1].pid)] = old_slots[i];
+        }
+    }
+    free(old_slots);
+    return 0;
+}
+
+// Makes room for job number id and its entries in free_ids and order
+static int reserve_jobs(int id) {
+    if (id <= jobs_capacity) {
+        return 0;
+    }
+    int new_capacity = (jobs_capacity == 0) ? 16 : jobs_capacity * 2;
+    Job *new_jobs = realloc(jobs, new_capacity * sizeof(Job));
+    int *new_free_ids = realloc(free_ids, new_capacity * sizeof(int));
+    int *new_order = realloc(order, new_capacity * sizeof(int));
+    if (new_jobs) jobs = new_jobs;
+    if (new_free_ids) free_ids = new_free_ids;
+    if (new_order) order = new_order;
+    if (!new_jobs || !new_free_ids || !new_order) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    memset(jobs + jobs_capacity, 0, (new_capacity - jobs_capacity) * sizeof(Job));
+    jobs_capacity = new_capacity;
+    return 0;
+}
+
+static void push_free_id(int id) {
+    int i = num_free_ids++;
+    while (i > 0 && free_ids[(i - 1) / 2] > id) {
+        free_ids[i] = free_ids[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    free_ids[i] = id;
+}
+
+static int pop_free_id(void) {
+    int lowest = free_ids[0];
+    int last = free_ids[--num_free_ids];
+    int i = 0;
+    while (2 * i + 1 < num_free_ids) {
+        int child = 2 * i + 1;
+        if (child + 1 < num_free_ids && free_ids[child + 1] < free_ids[child]) child++;
+        if (free_ids[child] >= last) break;
+        free_ids[i] = free_ids[child];
+        i = child;
+    }
+    free_ids[i] = last;
+    return lowest;
+}
+
+static int compare_jobs(const Job *a, const Job *b) {
+    int c = strcmp(a->command, b->command);
+    if (c != 0) return c;
+    return (a->pid > b->pid) - (a->pid < b->pid);
+}
+
+// Returns the position of job in the ordered index, or where it would go
+static int order_position(const Job *job) {
+    int low = 0, high = num_jobs;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (compare_jobs(&jobs[order[mid] - 1], job) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void remove_from_order(const Job *job) {
+    int pos = order_position(job);
+    memmove(order + pos, order + pos + 1, (num_jobs - pos - 1) * sizeof(int));
+    num_jobs--;
+}
+
+static void insert_into_order(const Job *job) {
+    int pos = order_position(job);
+    memmove(order + pos + 1, order + pos, (num_jobs - pos) * sizeof(int));
+    order[pos] = job->id;
+    num_jobs++;
+}
+
+int add_process(pid_t pid, const char *command) {
+    Job *job = find_process(pid);
+    if (job != NULL) {
+        // Already a job (e.g. stopped again): only its name may change
+        remove_from_order(job);
+        strncpy(job->command, command, sizeof(job->command) - 1);
+        insert_into_order(job);
+        return job->id;
+    }
+
+    if ((unsigned)(num_jobs + 1) * 2 > pid_table_size && grow_pid_table() != 0) {
+        return -1;
+    }
+    int id = (num_free_ids > 0) ? free_ids[0] : next_job_id;
+    if (reserve_jobs(id) != 0) {
+        return -1;
+    }
+    if (num_free_ids > 0) {
+        pop_free_id();
+    } else {
+        next_job_id++;
+    }
+
+    job = &jobs[id - 1];
+    job->pid = pid;
+    job->id = id;
+    job->state = JOB_RUNNING;
+    strncpy(job->command, command, sizeof(job->command) - 1);
+    job->command[sizeof(job->command) - 1] = '\0';
+    pid_slots[pid_slot(pid)] = id;
+    insert_into_order(job);
+    return id;
+}
+
+void remove_process(pid_t pid) {
+    if (pid_table_size == 0) return;
+    unsigned i = pid_slot(pid);
+    if (pid_slots[i] == 0) return;
+
+    Job *job = &jobs[pid_slots[i] - 1];
+    remove_from_order(job);
+    push_free_id(job->id);
+    job->pid = 0;
+
+    // Backward-shift deletion keeps every probe sequence unbroken
+    unsigned mask = pid_table_size - 1;
+    unsigned j = i;
+    while (1) {
+        pid_slots[i] = 0;
+        while (1) {
+            j = (j + 1) & mask;
+            if (pid_slots[j] == 0) return;
+            unsigned home = pid_hash(jobs[pid_slots[j] - 1].pid);
+            // Move the entry back unless its home lies cyclically in (i, j]
+            if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) break;
+        }
+        pid_slots[i] = pid_slots[j];
+        i = j;
+    }
+}
+
+Job *find_process(pid_t pid) {
+    if (pid_table_size == 0) return NULL;
+    int id = pid_slots[pid_slot(pid)];
+    return id ? &jobs[id - 1] : NULL;
+}
+
+Job *find_job(int id) {
+    if (id < 1 || id > jobs_capacity || jobs[id - 1].pid == 0) return NULL;
+    return &jobs[id - 1];
+}
+
+const char *get_process_name(pid_t pid) {
+    Job *job = find_process(pid);
+    return job ? job->command : "Unknown";
+}
+
+int job_count(void) {
+    return num_jobs;
+}
+
+Job *job_at(int index) {
+    return &jobs[order[index] - 1];
+}
+
+void free_process_list() {
+    free(jobs);
+    free(free_ids);
+    free(pid_slots);
+    free(order);
+    jobs = NULL;
+    free_ids = pid_slots = order = NULL;
+    jobs_capacity = num_free_ids = num_jobs = 0;
+    pid_table_size = 0;
+    next_job_id = 1;
+}
+
+void set_process_state(pid_t pid, JobState state) {
+    Job *job = find_process(pid);
+    if (job != NULL) {
+        job->state = state;
+    }
+}
+
+// Reads the state letter of a process from /proc/<pid>/stat. The command name
+// before it is in parentheses and may itself contain spaces or ')', so the
+// letter is found after the last ')'.
+static JobState read_proc_state(pid_t pid) {
+    char path[64];
+    char stat[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return JOB_UNKNOWN;
+    ssize_t length = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (length <= 0) return JOB_UNKNOWN;
+    stat[length] = '\0';
+
+    char *end = strrchr(stat, ')');
+    if (end == NULL || end[1] != ' ') return JOB_UNKNOWN;
+    // T is stopped by a signal, t is stopped by a debugger
+    return (end[2] == 'T' || end[2] == 't') ? JOB_STOPPED : JOB_RUNNING;
+}
+
+const char* get_process_state(pid_t pid) {
+    Job *job = find_process(pid);
+    JobState state = job ? job->state : JOB_UNKNOWN;
+    if (state == JOB_UNKNOWN) {
+        state = read_proc_state(pid);
+        if (job != NULL) job->state = state;
+    }
+    switch (state) {
+        case JOB_RUNNING: return "Running";
+        case JOB_STOPPED: return "Stopped";
+        default: return "Unknown";
+    }
+}
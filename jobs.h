@@ -0,0 +1,37 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+
+typedef enum JobState {
+    JOB_UNKNOWN,          // Read from /proc when it is needed
+    JOB_RUNNING,
+    JOB_STOPPED
+} JobState;
+
+// A background or stopped process the shell keeps track of
+typedef struct Job {
+    pid_t pid;            // 0 if this job number is free
+    int id;               // Small job number, used as %id by fg and bg
+    JobState state;       // Kept up to date from waitpid events (see events.c)
+    char command[256];
+} Job;
+
+// Function declarations
+// Adds a running job under the lowest free job number and returns that number
+int add_process(pid_t pid, const char *command);
+void set_process_state(pid_t pid, JobState state);
+void remove_process(pid_t pid);
+Job *find_process(pid_t pid);  // NULL if pid is not a job
+Job *find_job(int id);         // NULL if no job has this number
+const char *get_process_name(pid_t pid);
+void free_process_list();
+// "Running", "Stopped" or "Unknown". Jobs answer from their tracked state;
+// /proc is only read for other pids or jobs whose state is not known.
+const char* get_process_state(pid_t pid);
+
+// Jobs in order of their command names (then pids), for 0 <= index < job_count()
+int job_count(void);
+Job *job_at(int index);
+
+#endif // JOBS_H
@@ -0,0 +1,136 @@
+#include "launch.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+LaunchStrategy launch_strategy = LAUNCH_SPAWN;
+
+static const char *strategy_names[] = { "spawn", "vfork", "fork" };
+
+int parse_launch_strategy(const char *name) {
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, strategy_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *launch_strategy_name(LaunchStrategy strategy) {
+    return strategy_names[strategy];
+}
+
+static pid_t spawn_program(const char *path, char **argv, const LaunchSpec *spec) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    if (spec->stdin_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, spec->stdin_fd, STDIN_FILENO);
+    }
+    if (spec->stdout_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, spec->stdout_fd, STDOUT_FILENO);
+    }
+    // The shell blocks the signals it reads through its signalfd
+    sigset_t empty;
+    sigemptyset(&empty);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    if (spec->new_group) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+// Sets up the child's descriptors and signal mask; shared by the vfork and
+// fork paths
+static void prepare_child(const LaunchSpec *spec) {
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    if (spec->new_group) {
+        setpgid(0, 0);
+    }
+    if (spec->stdin_fd >= 0) {
+        dup2(spec->stdin_fd, STDIN_FILENO);
+    }
+    if (spec->stdout_fd >= 0) {
+        dup2(spec->stdout_fd, STDOUT_FILENO);
+    }
+}
+
+static pid_t vfork_program(const char *path, char **argv, const LaunchSpec *spec) {
+    // The vforked child shares our memory, so it can hand back its errno
+    static volatile int exec_errno;
+    exec_errno = 0;
+
+    pid_t pid = vfork();
+    if (pid == 0) {
+        prepare_child(spec);
+        execve(path, argv, environ);
+        exec_errno = errno;
+        _exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    if (exec_errno != 0) {
+        waitpid(pid, NULL, 0);
+        errno = exec_errno;
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t fork_program(const char *path, char **argv, const LaunchSpec *spec) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        prepare_child(spec);
+        execve(path, argv, environ);
+        // execvp also runs scripts without a #! line through /bin/sh
+        execvp(argv[0], argv);
+        printf(RED "ERROR : '%s' is not a valid command\n" RESET, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+pid_t launch_program(const char *path, char **argv, const LaunchSpec *spec) {
+    pid_t pid;
+    switch (launch_strategy) {
+        case LAUNCH_SPAWN:
+            pid = spawn_program(path, argv, spec);
+            break;
+        case LAUNCH_VFORK:
+            pid = vfork_program(path, argv, spec);
+            break;
+        default:
+            return fork_program(path, argv, spec);
+    }
+
+    // Only a real fork can fall back to running the file through /bin/sh
+    if (pid < 0 && errno == ENOEXEC) {
+        return fork_program(path, argv, spec);
+    }
+    return pid;
+}
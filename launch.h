@@ -0,0 +1,32 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+// How child programs are started
+typedef enum LaunchStrategy {
+    LAUNCH_SPAWN,   // posix_spawn (clone(CLONE_VM|CLONE_VFORK) in glibc)
+    LAUNCH_VFORK,   // vfork + execve
+    LAUNCH_FORK     // fork + execve, copying the shell's page tables
+} LaunchStrategy;
+
+// File descriptors the child starts with. Every descriptor passed here
+// should be close-on-exec so that the child only keeps fds 0, 1 and 2.
+typedef struct LaunchSpec {
+    int stdin_fd;         // Installed as fd 0 if >= 0
+    int stdout_fd;        // Installed as fd 1 if >= 0
+    int new_group;        // 1 to start the child in its own process group
+} LaunchSpec;
+
+extern LaunchStrategy launch_strategy;
+
+// Starts path with argv. Returns the child's pid, or -1 with errno set if the
+// program could not be started.
+pid_t launch_program(const char *path, char **argv, const LaunchSpec *spec);
+
+// Maps "spawn", "vfork" or "fork" to a strategy. Returns -1 for other names.
+int parse_launch_strategy(const char *name);
+
+const char *launch_strategy_name(LaunchStrategy strategy);
+
+#endif // LAUNCH_H
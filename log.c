@@ -1,23 +1,33 @@
+#define _GNU_SOURCE  // memmem
 #include "log.h"
+#include "trigram.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include "color.h"
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/file.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
 #define MAX_PATH_LENGTH 4096  // Increased buffer size for paths
 
 static char log_directory[MAX_PATH_LENGTH] = "";  // Buffer to store the log directory path
 static char log_file_path[MAX_PATH_LENGTH] = "";  // Buffer to store the full path to the log file
-static char *last_command = NULL;  // Store the last command
+static char index_file_path[MAX_PATH_LENGTH] = "";  // Path of the offset index next to it
+static char lock_file_path[MAX_PATH_LENGTH] = "";  // Serializes the shells sharing the history
 
 void set_log_directory(const char *home_dir) {
     // Calculate the lengths of the home directory and the log directory name
     size_t home_len = strlen(home_dir);
-    size_t log_dir_len = strlen(".shell_logs");
+    size_t log_dir_len = strlen(LOG_DIRECTORY);
 
     // Ensure the buffer is large enough for the home directory and log directory path
     if (home_len + log_dir_len + 2 >= sizeof(log_directory)) { // +2 for '/' and null terminator
@@ -26,8 +36,7 @@ void set_log_directory(const char *home_dir) {
     }
 
     // Construct the log directory path
-    strncpy(log_directory, home_dir, sizeof(log_directory) - 1);
-    strncat(log_directory, "/.shell_logs", sizeof(log_directory) - strlen(log_directory) - 1);
+    snprintf(log_directory, sizeof(log_directory), "%s/%s", home_dir, LOG_DIRECTORY);
 
     // Calculate the lengths of the log directory path and the log file name
     size_t log_dir_path_len = strlen(log_directory);
@@ -43,6 +52,12 @@ void set_log_directory(const char *home_dir) {
     strncpy(log_file_path, log_directory, sizeof(log_file_path) - 1);
     strncat(log_file_path, "/", sizeof(log_file_path) - strlen(log_file_path) - 1);
     strncat(log_file_path, LOG_FILE, sizeof(log_file_path) - strlen(log_file_path) - 1);
+    strncpy(index_file_path, log_directory, sizeof(index_file_path) - 1);
+    strncat(index_file_path, "/", sizeof(index_file_path) - strlen(index_file_path) - 1);
+    strncat(index_file_path, LOG_INDEX_FILE, sizeof(index_file_path) - strlen(index_file_path) - 1);
+    strncpy(lock_file_path, log_directory, sizeof(lock_file_path) - 1);
+    strncat(lock_file_path, "/", sizeof(lock_file_path) - strlen(lock_file_path) - 1);
+    strncat(lock_file_path, LOG_LOCK_FILE, sizeof(lock_file_path) - strlen(lock_file_path) - 1);
 
     // Create the log directory if it does not exist
     struct stat st = {0};
@@ -55,190 +70,771 @@ void set_log_directory(const char *home_dir) {
 }
 
 
-// Initialize logging
-void init_log() {
-    last_command = NULL;
+// The history is an append-only file of binary records (see LogRecord) plus
+// an index file holding the offset of each record that is part of the
+// history. The index is mapped into memory, so finding the n-th command is a
+// single lookup and logging a command appends to both files without reading
+// either. Old entries are only dropped when the log has grown to twice the
+// retention, by writing the newest ones to fresh files that replace the old ones.
+//
+// Every shell of the user shares these files. Each one maps the same index,
+// and all access happens under an flock of the lock file, which is never
+// replaced. A shell that logs a command indexes it itself, so the others see
+// it by reading the shared count, without rereading the log. A shell that
+// finds the log replaced by another one's compaction simply reopens it.
+#define LOG_INDEX_MAGIC 0x32584449474f4cULL  // "LOGIDX2"
+#define LOG_RECORD_MAGIC 0x52474f4cU         // "LOGR"
+#define LOG_RECORD_REPEAT 1  // Same command as the one before: counted by 'log stats' only
+#define LOG_COPY_CHUNK 65536
+
+// One finished command. The command and then the working directory follow
+// the header, and the whole record is padded to a multiple of 8 bytes.
+typedef struct LogRecord {
+    uint32_t magic;        // LOG_RECORD_MAGIC
+    uint32_t size;         // Bytes in the whole record
+    uint32_t command_length;
+    uint16_t cwd_length;
+    uint16_t flags;        // LOG_RECORD_*
+    int64_t start_us;      // When it started, in microseconds since the epoch
+    int64_t duration_us;
+    int32_t status;        // Wait status of its last program
+    int32_t pid;           // The shell that ran it
+} LogRecord;
+
+typedef struct LogIndex {
+    uint64_t magic;
+    uint64_t log_inode;    // The log file the offsets belong to
+    uint64_t count;        // Number of records in the history
+    uint64_t log_size;     // Bytes of the log covered by the records
+    uint64_t offsets[];    // Where each record starts
+} LogIndex;
+
+static int log_fd = -1;
+static int index_fd = -1;
+static int lock_fd = -1;
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;  // The flock does not exclude threads
+static LogIndex *log_index = NULL;  // Mapping of the index file
+static size_t index_capacity = 0;   // Offsets the mapping has room for
+static size_t retention = LOG_RETENTION;  // 0 keeps every entry
+
+// Read-only mapping of the log, through which every record is read
+static const char *log_map = NULL;
+static size_t log_map_size = 0;
+
+// Trigram index of the commands, built on the first search and kept up to
+// date as commands are logged; its ids are positions in the history
+static TrigramIndex search_index;
+static size_t indexed_records = 0;
+
+static size_t index_bytes(size_t capacity) {
+    return sizeof(LogIndex) + capacity * sizeof(uint64_t);
 }
 
-// Clean up resources
-void cleanup_log() {
-    if (last_command != NULL) {
-        free(last_command);
-        last_command = NULL;
+// Maps the index file with room for at least capacity offsets
+static int map_index(size_t capacity) {
+    if (log_index != NULL) {
+        munmap(log_index, index_bytes(index_capacity));
+        log_index = NULL;
+    }
+    // Another shell may have grown the file further already
+    struct stat st;
+    if (fstat(index_fd, &st) != 0 ||
+        ((size_t)st.st_size < index_bytes(capacity) && ftruncate(index_fd, index_bytes(capacity)) != 0)) {
+        perror(RED "Error growing log index" RESET);
+        return -1;
+    }
+    if ((size_t)st.st_size > index_bytes(capacity)) {
+        capacity = (st.st_size - sizeof(LogIndex)) / sizeof(uint64_t);
+    }
+    void *map = mmap(NULL, index_bytes(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    if (map == MAP_FAILED) {
+        perror(RED "Error mapping log index" RESET);
+        return -1;
+    }
+    log_index = map;
+    index_capacity = capacity;
+    return 0;
+}
+
+static int add_offset(uint64_t offset) {
+    if (log_index->count == index_capacity && map_index(index_capacity * 2) != 0) {
+        return -1;
+    }
+    log_index->offsets[log_index->count++] = offset;
+    return 0;
+}
+
+static void unmap_log(void) {
+    if (log_map != NULL) {
+        munmap((void *)log_map, log_map_size);
+        log_map = NULL;
+        log_map_size = 0;
+    }
+}
+
+// Maps at least the first size bytes of the log. The mapping is made larger
+// than that so that it is not redone for every command that is logged; only
+// the part backed by the file is ever read.
+static int map_log(uint64_t size) {
+    if (size <= log_map_size) {
+        return 0;
     }
+    unmap_log();
+    void *map = mmap(NULL, size * 2, PROT_READ, MAP_SHARED, log_fd, 0);
+    if (map == MAP_FAILED) {
+        perror(RED "Error mapping log file" RESET);
+        return -1;
+    }
+    log_map = map;
+    log_map_size = size * 2;
+    return 0;
+}
+
+static const LogRecord *record_at(uint64_t offset) {
+    return (const LogRecord *)(log_map + offset);
+}
+
+// The record of the i-th entry of the history; the log must be mapped
+static const LogRecord *history_record(size_t i) {
+    return record_at(log_index->offsets[i]);
 }
 
-// Trim the log file to keep only the most recent entries
-void trim_log_file() {
-    FILE *log_file = fopen(log_file_path, "r");
-    if (log_file == NULL) {
-        perror(RED "Error opening log file for trimming" RESET);
+static const char *record_command(const LogRecord *record) {
+    return (const char *)(record + 1);
+}
+
+// Indexes the complete records written after the part the index covers. This
+// rebuilds a missing or stale index, and picks up records written by a shell
+// that died before indexing them. Must be called with the lock held.
+static void index_new_records(void) {
+    struct stat st;
+    if (fstat(log_fd, &st) != 0 || (uint64_t)st.st_size <= log_index->log_size ||
+        map_log(st.st_size) != 0) {
         return;
     }
+    uint64_t position = log_index->log_size;
+    while (position + sizeof(LogRecord) <= (uint64_t)st.st_size) {
+        const LogRecord *record = record_at(position);
+        if (record->magic != LOG_RECORD_MAGIC || record->size < sizeof(LogRecord) ||
+            position + record->size > (uint64_t)st.st_size) {
+            break;  // Damaged, or still being written
+        }
+        if (!(record->flags & LOG_RECORD_REPEAT) && add_offset(position) != 0) {
+            return;  // The records are intact; a later call indexes the rest
+        }
+        position += record->size;
+        log_index->log_size = position;
+    }
+
+    // Only a damaged or short record gets here with bytes left over. Nobody
+    // writes without the lock, so they are the torn end of a write that never
+    // finished. Records appended after it could not be read.
+    if (position < (uint64_t)st.st_size && ftruncate(log_fd, position) != 0) {
+        perror(RED "Error repairing log file" RESET);
+    }
+}
+
+// Forgets the search structures, e.g. because the records were renumbered
+static void reset_search(void) {
+    unmap_log();
+    trigram_index_clear(&search_index);
+    indexed_records = 0;
+}
+
+static void close_log_files(void) {
+    reset_search();
+    if (log_index != NULL) {
+        munmap(log_index, index_bytes(index_capacity));
+        log_index = NULL;
+    }
+    if (index_fd >= 0) close(index_fd);
+    if (log_fd >= 0) close(log_fd);
+    index_fd = log_fd = -1;
+}
+
+// Opens the log and its index, rebuilding the index if it does not belong to
+// this log file. Must be called with the lock held.
+static int open_log_files(void) {
+    log_fd = open(log_file_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    index_fd = open(index_file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat log_st, index_st;
+    if (log_fd < 0 || index_fd < 0 || fstat(log_fd, &log_st) != 0 || fstat(index_fd, &index_st) != 0) {
+        perror(RED "Error opening log file" RESET);
+        close_log_files();
+        return -1;
+    }
 
-    // Read all lines into a dynamic list
-    char *lines[MAX_LOG_ENTRIES];
-    size_t num_lines = 0;
-    char line[256];
+    size_t capacity = 1024;
+    if ((size_t)index_st.st_size > index_bytes(capacity)) {
+        capacity = (index_st.st_size - sizeof(LogIndex)) / sizeof(uint64_t);
+    }
+    if (map_index(capacity) != 0) {
+        close_log_files();
+        return -1;
+    }
+    if (log_index->magic != LOG_INDEX_MAGIC || log_index->log_inode != (uint64_t)log_st.st_ino ||
+        log_index->count > index_capacity || log_index->log_size > (uint64_t)log_st.st_size) {
+        log_index->magic = LOG_INDEX_MAGIC;
+        log_index->log_inode = log_st.st_ino;
+        log_index->count = 0;
+        log_index->log_size = 0;
+    }
+    index_new_records();
+    return 0;
+}
 
-    // Read all lines from the log file
-    while (fgets(line, sizeof(line), log_file) != NULL) {
-        if (num_lines >= MAX_LOG_ENTRIES) {
-            free(lines[num_lines % MAX_LOG_ENTRIES]);
+static void unlock_log(void) {
+    flock(lock_fd, LOCK_UN);
+    pthread_mutex_unlock(&history_mutex);
+}
+
+// Takes the lock and brings this shell's view of the history up to date.
+// Returns -1 (without the lock) if the history cannot be used.
+static int lock_log(void) {
+    pthread_mutex_lock(&history_mutex);
+    if (lock_fd < 0) {
+        pthread_mutex_unlock(&history_mutex);
+        return -1;
+    }
+    while (flock(lock_fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            perror(RED "Error locking log file" RESET);
+            pthread_mutex_unlock(&history_mutex);
+            return -1;
         }
-        lines[num_lines % MAX_LOG_ENTRIES] = strdup(line);
-        num_lines++;
     }
-    
-    fclose(log_file);
 
-    // Open file for writing and maintain order
-    log_file = fopen(log_file_path, "w");
-    if (log_file == NULL) {
-        perror(RED "Error opening log file for writing" RESET);
-        return;
+    // Another shell's compaction or purge renames new files over the old ones
+    struct stat path_st, log_st;
+    if (log_fd < 0 || stat(log_file_path, &path_st) != 0 || fstat(log_fd, &log_st) != 0 ||
+        path_st.st_ino != log_st.st_ino) {
+        close_log_files();
+        open_log_files();
+    }
+    if (log_index == NULL) {
+        unlock_log();
+        return -1;
     }
 
-    // Write the most recent MAX_LOG_ENTRIES lines
-    size_t start_index = (num_lines > MAX_LOG_ENTRIES) ? (num_lines % MAX_LOG_ENTRIES) : 0;
-    size_t entries_to_write = (num_lines > MAX_LOG_ENTRIES) ? MAX_LOG_ENTRIES : num_lines;
+    // The index file may have been grown by another shell
+    size_t needed = log_index->count + 1;
+    if (needed > index_capacity && map_index(needed) != 0) {
+        unlock_log();
+        return -1;
+    }
+    if (indexed_records > log_index->count) {
+        reset_search();
+    }
+    index_new_records();
+    return 0;
+}
 
-    for (size_t i = 0; i < entries_to_write; i++) {
-        fprintf(log_file, "%s", lines[(start_index + i) % MAX_LOG_ENTRIES]);
-        free(lines[(start_index + i) % MAX_LOG_ENTRIES]);
+
+// Number of entries that can be shown or executed
+static size_t visible_entries(void) {
+    if (log_index == NULL) {
+        return 0;
     }
+    size_t count = log_index->count;
+    return (retention > 0 && count > retention) ? retention : count;
+}
 
-    fclose(log_file);
+// Maps the log and returns the number of visible entries, or 0 if there are
+// none or they cannot be read
+static size_t map_history(void) {
+    size_t visible = visible_entries();
+    if (visible == 0 || map_log(log_index->log_size) != 0) {
+        return 0;
+    }
+    return visible;
 }
 
-// Print the log contents
-void print_log() {
-    FILE *log_file = fopen(log_file_path, "r");
-    if (log_file == NULL) {
-        perror(RED "Error opening log file for reading" RESET);
-        return;
+// Copies bytes [from, to) of the log to fd
+static int copy_log_range(int fd, uint64_t from, uint64_t to) {
+    char buffer[LOG_COPY_CHUNK];
+    while (from < to) {
+        size_t want = (to - from < sizeof(buffer)) ? to - from : sizeof(buffer);
+        ssize_t got = pread(log_fd, buffer, want, from);
+        if (got <= 0) {
+            return -1;
+        }
+        for (ssize_t done = 0; done < got;) {
+            ssize_t written = write(fd, buffer + done, got - done);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            done += written;
+        }
+        from += got;
     }
+    return 0;
+}
 
-    char line[256];
-    while (fgets(line, sizeof(line), log_file) != NULL) {
-        printf("%s", line);
+// Rewrites the log and its index with only the newest keep entries.
+// Both are built under temporary names and renamed over the old files; if the
+// shell dies in between, the index no longer matches the log's inode and is
+// rebuilt when the log is next opened. Other shells notice the new inode.
+static void compact_log(size_t keep) {
+    size_t first = log_index->count - keep;
+    uint64_t base = (keep > 0) ? log_index->offsets[first] : log_index->log_size;
+    char log_tmp[MAX_PATH_LENGTH + 8], index_tmp[MAX_PATH_LENGTH + 8];
+    snprintf(log_tmp, sizeof(log_tmp), "%s.tmp", log_file_path);
+    snprintf(index_tmp, sizeof(index_tmp), "%s.tmp", index_file_path);
+
+    int new_log = open(log_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int new_index = open(index_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    struct stat st;
+    if (new_log < 0 || new_index < 0 || fstat(new_log, &st) != 0 ||
+        copy_log_range(new_log, base, log_index->log_size) != 0) {
+        perror(RED "Error compacting log file" RESET);
+        goto fail;
     }
 
-    fclose(log_file);
+    LogIndex header = { LOG_INDEX_MAGIC, st.st_ino, keep, log_index->log_size - base };
+    uint64_t *offsets = malloc((keep + 1) * sizeof(uint64_t));
+    if (offsets == NULL) {
+        perror(RED "malloc failed" RESET);
+        goto fail;
+    }
+    for (size_t i = 0; i < keep; i++) {
+        offsets[i] = log_index->offsets[first + i] - base;
+    }
+    int ok = write(new_index, &header, sizeof(header)) == sizeof(header) &&
+             write(new_index, offsets, keep * sizeof(uint64_t)) == (ssize_t)(keep * sizeof(uint64_t));
+    free(offsets);
+    if (!ok || rename(log_tmp, log_file_path) != 0 || rename(index_tmp, index_file_path) != 0) {
+        perror(RED "Error compacting log file" RESET);
+        goto fail;
+    }
+    close(new_log);
+    close(new_index);
+    close_log_files();
+    open_log_files();
+    return;
+
+fail:
+    if (new_log >= 0) close(new_log);
+    if (new_index >= 0) close(new_index);
+    unlink(log_tmp);
+    unlink(index_tmp);
 }
 
-// Log a new command
-void log_command(const char *command) {
-    // Check if the command contains "log"
-    if (strstr(command, "log") != NULL) {
+// Adds the records logged since the last search to the trigram index
+static void update_search_index(void) {
+    for (; indexed_records < log_index->count; indexed_records++) {
+        const LogRecord *record = history_record(indexed_records);
+        trigram_index_add(&search_index, indexed_records, record_command(record), record->command_length);
+    }
+}
+
+// Commands are not written as they finish. log_command only appends the
+// encoded record to the pending batch; a writer thread appends whole batches
+// to the log once LOG_BATCH_RECORDS have piled up or LOG_FLUSH_INTERVAL_MS
+// after the first of them, so running a command never waits for the disk.
+// Everything that reads the history syncs first, so a shell always sees its
+// own commands.
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;    // Wakes the writer
+static pthread_cond_t flushed_cond = PTHREAD_COND_INITIALIZER;  // A batch is written
+static char *pending = NULL;      // Encoded records waiting to be written
+static size_t pending_length = 0;
+static size_t pending_capacity = 0;
+static size_t pending_records = 0;
+static uint64_t queued_batches = 0;   // Batches started by log_command
+static uint64_t flushed_batches = 0;  // Of those, the ones written
+static int sync_requested = 0;
+static int writer_stopping = 0;
+static int writer_running = 0;
+static pthread_t writer_thread;
+
+// Appends the batch to the log in one write and indexes it. Must be called
+// with the lock held; the records are taken over by the log.
+static void write_batch(char *batch, size_t length) {
+    if (map_log(log_index->log_size) != 0) {
         return;
     }
 
-    // Check if the command is the same as the last one
-    if (last_command != NULL && strcmp(last_command, command) == 0) {
+    // A repeat of the last command in the shared history is only kept for its timing
+    const char *last = NULL;
+    size_t last_length = 0;
+    if (log_index->count > 0) {
+        const LogRecord *record = history_record(log_index->count - 1);
+        last = record_command(record);
+        last_length = record->command_length;
+    }
+    for (size_t position = 0; position < length;) {
+        LogRecord *record = (LogRecord *)(batch + position);
+        if (last != NULL && record->command_length == last_length &&
+            memcmp(record_command(record), last, last_length) == 0) {
+            record->flags |= LOG_RECORD_REPEAT;
+        } else {
+            last = record_command(record);
+            last_length = record->command_length;
+        }
+        position += record->size;
+    }
+
+    // One O_APPEND write, so even a writer that ignored the lock could not split it
+    ssize_t written = write(log_fd, batch, length);
+    if (written != (ssize_t)length) {
+        perror(RED "Error writing log file" RESET);
+        index_new_records();  // Keeps the records that made it, drops a torn one
         return;
     }
+    uint64_t base = log_index->log_size;
+    for (size_t position = 0; position < length;) {
+        const LogRecord *record = (const LogRecord *)(batch + position);
+        if (!(record->flags & LOG_RECORD_REPEAT) && add_offset(base + position) != 0) {
+            break;
+        }
+        position += record->size;
+        log_index->log_size = base + position;
+    }
 
-    // Update the last command
-    if (last_command != NULL) {
-        free(last_command);
+    if (retention > 0 && log_index->count >= 2 * retention) {
+        compact_log(retention);  // Renumbers the records, so the search index starts over
+    } else if (indexed_records > 0 && map_log(log_index->log_size) == 0) {
+        update_search_index();
     }
-    last_command = strdup(command);
+}
 
-    // Trim the log file if necessary
-    trim_log_file();
+// Writes out everything queued so far. Only ever runs on one thread at a time:
+// the writer thread, or the shell itself when there is none.
+static void flush_pending(void) {
+    pthread_mutex_lock(&queue_mutex);
+    char *batch = pending;
+    size_t length = pending_length;
+    uint64_t batches = queued_batches;
+    pending = NULL;
+    pending_length = pending_capacity = pending_records = 0;
+    pthread_mutex_unlock(&queue_mutex);
+
+    if (length > 0 && lock_log() == 0) {
+        write_batch(batch, length);
+        unlock_log();
+    }
+    free(batch);
 
-    // Log the command
-    FILE *log_file = fopen(log_file_path, "a");
-    if (log_file == NULL) {
-        perror(RED "Error opening log file" RESET);
-        return;
+    pthread_mutex_lock(&queue_mutex);
+    flushed_batches = batches;
+    pthread_cond_broadcast(&flushed_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+static void *writer_main(void *arg) {
+    pthread_mutex_lock(&queue_mutex);
+    while (!writer_stopping || pending_records > 0) {
+        if (pending_records == 0 && !sync_requested && !writer_stopping) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+            continue;
+        }
+
+        // The first record of a batch waits at most LOG_FLUSH_INTERVAL_MS
+        if (pending_records < LOG_BATCH_RECORDS && !sync_requested && !writer_stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += LOG_FLUSH_INTERVAL_MS / 1000;
+            deadline.tv_nsec += (LOG_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            int waited = 0;
+            while (!waited && pending_records < LOG_BATCH_RECORDS && !sync_requested && !writer_stopping) {
+                waited = (pthread_cond_timedwait(&queue_cond, &queue_mutex, &deadline) == ETIMEDOUT);
+            }
+        }
+
+        sync_requested = 0;
+        pthread_mutex_unlock(&queue_mutex);
+        flush_pending();
+        pthread_mutex_lock(&queue_mutex);
     }
-    fprintf(log_file, "%s\n", command);
-    fclose(log_file);
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
 }
 
-// Purge the log file
-void log_purge() {
-    FILE *log_file = fopen(log_file_path, "w");
-    if (log_file == NULL) {
-        perror(RED "Error opening log file for purging" RESET);
+// Waits until every command logged so far is in the log
+void log_sync(void) {
+    if (!writer_running) {
+        flush_pending();
         return;
     }
+    pthread_mutex_lock(&queue_mutex);
+    uint64_t target = queued_batches;
+    if (flushed_batches < target) {
+        sync_requested = 1;
+        pthread_cond_signal(&queue_cond);
+    }
+    while (flushed_batches < target) {
+        pthread_cond_wait(&flushed_cond, &queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
 
-    // Clear the contents of the log file
-    fclose(log_file);
+// A forked child only has the thread that forked. It starts over with fresh
+// locks, leaves the parent's queue to the parent and writes its own commands
+// itself. Whatever the writer thread was using may be half updated, so the
+// files are reopened on first use.
+static void log_after_fork(void) {
+    pthread_mutex_init(&history_mutex, NULL);
+    pthread_mutex_init(&queue_mutex, NULL);
+    pthread_cond_init(&queue_cond, NULL);
+    pthread_cond_init(&flushed_cond, NULL);
+    writer_running = 0;
+    writer_stopping = 0;
+    sync_requested = 0;
+    pending = NULL;
+    pending_length = pending_capacity = pending_records = 0;
+    queued_batches = flushed_batches = 0;
+
+    if (log_fd >= 0) close(log_fd);
+    if (index_fd >= 0) close(index_fd);
+    log_fd = index_fd = -1;
+    log_index = NULL;
+    index_capacity = 0;
+    log_map = NULL;
+    log_map_size = 0;
+    memset(&search_index, 0, sizeof(search_index));
+    indexed_records = 0;
+
+    // flock is shared by everyone holding the same open file, parent included
+    if (lock_fd >= 0) {
+        close(lock_fd);
+        lock_fd = open(lock_file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
 }
 
-// Retrieve a command from the log by index
-char* get_command_from_log(int index) {
-    if (index < 1) {
-        fprintf(stderr,RED "Error: Index must be greater than 0.\n" RESET);
-        return NULL;
+static void start_writer(void) {
+    // The thread must not take the signals the shell reads from its signalfd
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    int error = pthread_create(&writer_thread, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (error != 0) {
+        errno = error;
+        perror(RED "Error starting log writer" RESET);  // Commands are then written as they finish
+        return;
     }
+    writer_running = 1;
+    pthread_atfork(NULL, NULL, log_after_fork);
+}
 
-    FILE *log_file = fopen(log_file_path, "r");
-    if (log_file == NULL) {
-        perror(RED "Error opening log file" RESET);
-        return NULL;
+static void stop_writer(void) {
+    if (!writer_running) {
+        flush_pending();
+        return;
     }
+    pthread_mutex_lock(&queue_mutex);
+    writer_stopping = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_join(writer_thread, NULL);
+    writer_running = 0;
+    writer_stopping = 0;
+}
 
-    // Count the number of lines in the log file
-    size_t num_lines = 0;
-    char line[256];
-    while (fgets(line, sizeof(line), log_file) != NULL) {
-        num_lines++;
+void log_search(const char *pattern, log_match_callback found, void *arg) {
+    log_sync();
+    if (lock_log() != 0) {
+        return;
     }
-    rewind(log_file);
+    size_t visible = map_history();
+    if (visible == 0) {
+        unlock_log();
+        return;
+    }
+    update_search_index();
 
-    // Determine the correct number of lines to read
-    size_t log_size = (num_lines > MAX_LOG_ENTRIES + 1) ? MAX_LOG_ENTRIES + 1 : num_lines;
+    int anchored = (pattern[0] == '^');
+    if (anchored) {
+        pattern++;
+    }
+    size_t length = strlen(pattern);
+    size_t count = log_index->count;
+    size_t first = count - visible;
+
+    // Only entries holding every trigram of the pattern are looked at
+    size_t num_candidates;
+    uint32_t *candidates = trigram_index_query(&search_index, pattern, length, &num_candidates);
+    if (num_candidates == SIZE_MAX) {
+        num_candidates = count;  // Too short to have trigrams: try every entry
+    }
+    for (size_t k = num_candidates; k-- > 0;) {
+        size_t i = (candidates != NULL) ? candidates[k] : k;
+        if (i < first) {
+            break;
+        }
+        const LogRecord *record = history_record(i);
+        const char *text = record_command(record);
+        size_t text_length = record->command_length;
+        int match = anchored ? (text_length >= length && memcmp(text, pattern, length) == 0)
+                             : (memmem(text, text_length, pattern, length) != NULL);
+        if (match && found(count - i, text, text_length, arg)) {
+            break;
+        }
+    }
+    free(candidates);
+    unlock_log();
+}
 
-    // Allocate an array to store the lines
-    char *lines[MAX_LOG_ENTRIES];
-    for (size_t i = 0; i < MAX_LOG_ENTRIES; i++) {
-        lines[i] = NULL;
+void log_for_each(log_entry_callback callback, void *arg) {
+    log_sync();
+    if (lock_log() != 0) {
+        return;
+    }
+    size_t visible = map_history();
+    if (visible == 0) {
+        unlock_log();
+        return;
+    }
+    uint64_t position = log_index->offsets[log_index->count - visible];
+    while (position < log_index->log_size) {
+        const LogRecord *record = record_at(position);
+        LogEntry entry = {
+            record_command(record), record->command_length,
+            record_command(record) + record->command_length, record->cwd_length,
+            record->start_us, record->duration_us, record->status, record->pid
+        };
+        callback(&entry, arg);
+        position += record->size;
     }
+    unlock_log();
+}
 
-    // Read lines from the file into the array
-    size_t current_index = 0;
-    while (fgets(line, sizeof(line), log_file) != NULL) {
-        size_t pos = (current_index) % MAX_LOG_ENTRIES;
-        if (lines[pos] != NULL) {
-            free(lines[pos]);
+// Initialize logging
+void init_log() {
+    // SHELL_LOG_SIZE=N keeps the last N commands; 0 keeps all of them
+    const char *size = getenv("SHELL_LOG_SIZE");
+    if (size != NULL && *size != '\0') {
+        char *end;
+        long value = strtol(size, &end, 10);
+        if (*end == '\0' && value >= 0) {
+            retention = value;
         }
-        lines[pos] = strdup(line);
-        current_index++;
     }
-    fclose(log_file);
 
-    // Validate the index
-    if (index > log_size) {
-        fprintf(stderr,RED "Error: Index exceeds the number of log entries.\n" RESET);
-        for (size_t i = 0; i < MAX_LOG_ENTRIES; i++) {
-            if (lines[i] != NULL) {
-                free(lines[i]);
-            }
-        }
-        return NULL;
+    lock_fd = open(lock_file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        perror(RED "Error opening log lock" RESET);
+        return;
     }
+    if (lock_log() == 0) {  // Opens the log files
+        unlock_log();
+        start_writer();
+    }
+}
+
+// Writes out what is still queued and closes the files. Safe to call more
+// than once, e.g. from handle_sigquit and again on the way out of main.
+void cleanup_log() {
+    stop_writer();
+    close_log_files();
+    if (lock_fd >= 0) {
+        close(lock_fd);
+        lock_fd = -1;
+    }
+}
 
-    // Calculate the actual index
-    size_t actual_index = (log_size - index) % MAX_LOG_ENTRIES;
-    char *result = strdup(lines[actual_index]);
+// Print the most recent LOG_PRINT_ENTRIES entries, oldest first
+void print_log() {
+    log_sync();
+    if (lock_log() != 0) {
+        return;
+    }
+    size_t count = map_history();
+    if (count > LOG_PRINT_ENTRIES) {
+        count = LOG_PRINT_ENTRIES;
+    }
+    for (size_t i = log_index->count - count; i < log_index->count; i++) {
+        const LogRecord *record = history_record(i);
+        printf("%.*s\n", (int)record->command_length, record_command(record));
+    }
+    unlock_log();
+}
 
-    // Remove the trailing newline, if present
-    size_t len = strlen(result);
-    if (len > 0 && result[len - 1] == '\n') {
-        result[len - 1] = '\0';
+// Log a command that has finished. The record is only queued here; it
+// reaches the log with the next batch.
+void log_command(const LogEntry *entry) {
+    // Check if the command contains "log"
+    if (strstr(entry->command, "log") != NULL) {
+        return;
     }
 
-    // Free allocated memory
-    for (size_t i = 0; i < MAX_LOG_ENTRIES; i++) {
-        if (lines[i] != NULL) {
-            free(lines[i]);
+    size_t cwd_length = entry->cwd_length > UINT16_MAX ? UINT16_MAX : entry->cwd_length;
+    size_t size = (sizeof(LogRecord) + entry->command_length + cwd_length + 7) & ~(size_t)7;
+
+    pthread_mutex_lock(&queue_mutex);
+    if (pending_length + size > pending_capacity) {
+        size_t capacity = (pending_capacity == 0) ? 4096 : pending_capacity;
+        while (capacity < pending_length + size) {
+            capacity *= 2;
         }
+        char *grown = realloc(pending, capacity);
+        if (grown == NULL) {
+            perror(RED "realloc failed" RESET);
+            pthread_mutex_unlock(&queue_mutex);
+            return;
+        }
+        pending = grown;
+        pending_capacity = capacity;
+    }
+    LogRecord *record = (LogRecord *)(pending + pending_length);
+    memset(record, 0, size);
+    *record = (LogRecord){
+        LOG_RECORD_MAGIC, size, entry->command_length, cwd_length, 0,
+        entry->start_us, entry->duration_us, entry->status, entry->pid
+    };
+    memcpy(record + 1, entry->command, entry->command_length);
+    memcpy((char *)(record + 1) + entry->command_length, entry->cwd, cwd_length);
+    pending_length += size;
+    if (pending_records++ == 0) {
+        queued_batches++;
+    }
+    if (pending_records == 1 || pending_records == LOG_BATCH_RECORDS) {
+        pthread_cond_signal(&queue_cond);  // Starts the clock on a new batch, or fills one
     }
+    pthread_mutex_unlock(&queue_mutex);
 
+    if (!writer_running) {
+        flush_pending();
+    }
+}
+
+// Purge the log file. Empty files replace the old ones, so that every other
+// shell notices and starts over as well.
+void log_purge() {
+    log_sync();
+    if (lock_log() != 0) {
+        return;
+    }
+    compact_log(0);
+    unlock_log();
+}
+
+// Retrieve a command from the log by index
+char* get_command_from_log(int index) {
+    if (index < 1) {
+        fprintf(stderr,RED "Error: Index must be greater than 0.\n" RESET);
+        return NULL;
+    }
+    log_sync();
+    if (lock_log() != 0) {
+        return NULL;
+    }
+    if ((size_t)index > map_history()) {
+        fprintf(stderr,RED "Error: Index exceeds the number of log entries.\n" RESET);
+        unlock_log();
+        return NULL;
+    }
+
+    const LogRecord *record = history_record(log_index->count - index);
+    char *result = strndup(record_command(record), record->command_length);
+    if (result == NULL) {
+        perror(RED "malloc failed" RESET);
+    }
+    unlock_log();
     return result;
 }
@@ -1,20 +1,57 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 // Function to set the log directory based on the home directory
 void set_log_directory(const char *home_dir);
-#define MAX_LOG_ENTRIES 14  // Define the maximum number of log entries
-#define LOG_FILE "command.log"  // Log file name, without directory
+#define LOG_DIRECTORY ".shell_logs"  // Under the shell's home directory
+#define LOG_FILE "history.log"  // Log file name, without directory
+#define LOG_INDEX_FILE "history.idx"  // Offsets of the records in LOG_FILE
+#define LOG_LOCK_FILE "history.lock"  // Locked by a shell while it uses the other two
+#define LOG_PRINT_ENTRIES 14  // Entries shown by a plain 'log'
+#define LOG_RETENTION 10000  // Entries kept unless SHELL_LOG_SIZE says otherwise
+#define LOG_BATCH_RECORDS 64  // Queued commands that are written out at once
+#define LOG_FLUSH_INTERVAL_MS 1000  // Longest a queued command waits to be written
+
+// A command that has finished, as it is logged
+typedef struct LogEntry {
+    const char *command;  // NUL-terminated when passed to log_command
+    size_t command_length;
+    const char *cwd;      // Directory it was started in (not NUL-terminated)
+    size_t cwd_length;
+    int64_t start_us;     // When it started, in microseconds since the epoch
+    int64_t duration_us;  // Wall-clock time it took
+    int status;           // Wait status of its last program (0 if only builtins ran)
+    pid_t pid;            // The shell that ran it
+} LogEntry;
 
 // Function declarations
+// Opens the history in the log directory; call after set_log_directory
 void init_log();
+// Writes out the queued commands and stops the writer thread
 void cleanup_log();
-void trim_log_file();
-void log_command(const char *command);
+void log_command(const LogEntry *entry);
+// Returns once every command logged so far has been written
+void log_sync(void);
 void print_log();
 void log_purge();
+// Returns a copy of the index-th most recent command (1 is the latest), or NULL
 char* get_command_from_log(int index);
 
+// Called by log_search for each match with the number 'log execute' takes for
+// it and the command (not NUL-terminated). Returning non-zero ends the search.
+typedef int (*log_match_callback)(int index, const char *command, size_t length, void *arg);
+
+// Finds the commands containing pattern, or starting with it if it begins
+// with '^', newest first
+void log_search(const char *pattern, log_match_callback found, void *arg);
+
+// Calls callback for every command within the retention, oldest first,
+// including repeats of the same command (which the history itself skips)
+typedef void (*log_entry_callback)(const LogEntry *entry, void *arg);
+void log_for_each(log_entry_callback callback, void *arg);
+
 #endif // LOG_H
@@ -0,0 +1,244 @@
+#include "logstats.h"
+#include "log.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Every run of one program (the first word of the command)
+typedef struct CommandStats {
+    char *name;           // NULL marks an empty slot
+    size_t runs;
+    size_t failed;
+    int64_t total_us;
+    int64_t *durations;   // Of every run, sorted once all are collected
+    size_t capacity;
+} CommandStats;
+
+// A command that is among the slowest so far
+typedef struct SlowCommand {
+    char *command;
+    int64_t start_us;
+    int64_t duration_us;
+    int status;
+} SlowCommand;
+
+typedef struct StatsState {
+    CommandStats *table;  // Open addressing, kept at most half full
+    size_t size;
+    size_t used;
+    SlowCommand slowest[LOG_STATS_SLOWEST];  // Slowest first
+    int num_slowest;
+} StatsState;
+
+static int command_failed(int status) {
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+static size_t hash_name(const char *name, size_t length) {
+    size_t hash = 5381;
+    for (size_t i = 0; i < length; i++) {
+        hash = hash * 33 + (unsigned char)name[i];
+    }
+    return hash;
+}
+
+static size_t find_slot(CommandStats *table, size_t size, const char *name, size_t length) {
+    size_t slot = hash_name(name, length) & (size - 1);
+    while (table[slot].name != NULL &&
+           (strncmp(table[slot].name, name, length) != 0 || table[slot].name[length] != '\0')) {
+        slot = (slot + 1) & (size - 1);
+    }
+    return slot;
+}
+
+static int grow_table(StatsState *state) {
+    size_t size = (state->size == 0) ? 64 : state->size * 2;
+    CommandStats *table = calloc(size, sizeof(CommandStats));
+    if (table == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    for (size_t i = 0; i < state->size; i++) {
+        CommandStats *stats = &state->table[i];
+        if (stats->name != NULL) {
+            table[find_slot(table, size, stats->name, strlen(stats->name))] = *stats;
+        }
+    }
+    free(state->table);
+    state->table = table;
+    state->size = size;
+    return 0;
+}
+
+// The stats of the program the command runs, created on first use
+static CommandStats *stats_for(StatsState *state, const char *command, size_t length) {
+    while (length > 0 && (*command == ' ' || *command == '\t')) {
+        command++;
+        length--;
+    }
+    size_t name_length = 0;
+    while (name_length < length && command[name_length] != ' ' && command[name_length] != '\t' &&
+           command[name_length] != ';' && command[name_length] != '|' && command[name_length] != '&') {
+        name_length++;
+    }
+
+    if ((state->used + 1) * 2 > state->size && grow_table(state) != 0) {
+        return NULL;
+    }
+    CommandStats *stats = &state->table[find_slot(state->table, state->size, command, name_length)];
+    if (stats->name == NULL) {
+        stats->name = strndup(command, name_length);
+        if (stats->name == NULL) {
+            perror(RED "malloc failed" RESET);
+            return NULL;
+        }
+        state->used++;
+    }
+    return stats;
+}
+
+static void add_run(CommandStats *stats, const LogEntry *entry) {
+    if (stats->runs == stats->capacity) {
+        size_t capacity = (stats->capacity == 0) ? 8 : stats->capacity * 2;
+        int64_t *durations = realloc(stats->durations, capacity * sizeof(int64_t));
+        if (durations == NULL) {
+            perror(RED "realloc failed" RESET);
+            return;
+        }
+        stats->durations = durations;
+        stats->capacity = capacity;
+    }
+    stats->durations[stats->runs++] = entry->duration_us;
+    stats->failed += command_failed(entry->status);
+    stats->total_us += entry->duration_us;
+}
+
+// Keeps the entry if it is among the LOG_STATS_SLOWEST slowest seen so far
+static void add_slow(StatsState *state, const LogEntry *entry) {
+    int position = state->num_slowest;
+    while (position > 0 && state->slowest[position - 1].duration_us < entry->duration_us) {
+        position--;
+    }
+    if (position == LOG_STATS_SLOWEST) {
+        return;
+    }
+    char *command = strndup(entry->command, entry->command_length);
+    if (command == NULL) {
+        perror(RED "malloc failed" RESET);
+        return;
+    }
+    if (state->num_slowest == LOG_STATS_SLOWEST) {
+        free(state->slowest[--state->num_slowest].command);
+    }
+    memmove(&state->slowest[position + 1], &state->slowest[position],
+            (state->num_slowest - position) * sizeof(SlowCommand));
+    state->slowest[position] = (SlowCommand){ command, entry->start_us, entry->duration_us, entry->status };
+    state->num_slowest++;
+}
+
+static void collect_entry(const LogEntry *entry, void *arg) {
+    StatsState *state = arg;
+    CommandStats *stats = stats_for(state, entry->command, entry->command_length);
+    if (stats != NULL) {
+        add_run(stats, entry);
+    }
+    add_slow(state, entry);
+}
+
+static int compare_durations(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Busiest programs first
+static int compare_total(const void *a, const void *b) {
+    const CommandStats *x = *(const CommandStats *const *)a, *y = *(const CommandStats *const *)b;
+    return (y->total_us > x->total_us) - (y->total_us < x->total_us);
+}
+
+// Nearest-rank percentile of sorted durations
+static int64_t percentile(const CommandStats *stats, int percent) {
+    size_t rank = (stats->runs * percent + 99) / 100;
+    return stats->durations[rank > 0 ? rank - 1 : 0];
+}
+
+// Formats a duration to fit a column, e.g. "840us", "12.3ms" or "4.20s"
+static const char *format_duration(int64_t us, char *buffer, size_t size) {
+    if (us < 1000) {
+        snprintf(buffer, size, "%lldus", (long long)us);
+    } else if (us < 1000000) {
+        snprintf(buffer, size, "%.1fms", us / 1000.0);
+    } else {
+        snprintf(buffer, size, "%.2fs", us / 1000000.0);
+    }
+    return buffer;
+}
+
+static void print_slowest(const StatsState *state) {
+    printf("Slowest commands:\n");
+    for (int i = 0; i < state->num_slowest; i++) {
+        const SlowCommand *slow = &state->slowest[i];
+        char duration[32], started[32];
+        time_t seconds = slow->start_us / 1000000;
+        struct tm tm;
+        strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime_r(&seconds, &tm));
+        int code = WIFEXITED(slow->status) ? WEXITSTATUS(slow->status) : 128 + WTERMSIG(slow->status);
+        printf("%10s  %s  exit %-3d  %s\n", format_duration(slow->duration_us, duration, sizeof(duration)),
+               started, code, slow->command);
+    }
+}
+
+static void print_per_command(StatsState *state) {
+    CommandStats **sorted = malloc(state->used * sizeof(CommandStats *));
+    if (sorted == NULL) {
+        perror(RED "malloc failed" RESET);
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < state->size; i++) {
+        CommandStats *stats = &state->table[i];
+        if (stats->name != NULL && stats->runs > 0) {
+            qsort(stats->durations, stats->runs, sizeof(int64_t), compare_durations);
+            sorted[count++] = stats;
+        }
+    }
+    qsort(sorted, count, sizeof(CommandStats *), compare_total);
+
+    printf("\n%-16s %6s %7s %10s %10s %10s %10s\n", "Command", "Runs", "Failed", "p50", "p95", "p99", "Total");
+    for (size_t i = 0; i < count; i++) {
+        const CommandStats *stats = sorted[i];
+        char p50[32], p95[32], p99[32], total[32];
+        printf("%-16s %6zu %6.1f%% %10s %10s %10s %10s\n", stats->name, stats->runs,
+               100.0 * stats->failed / stats->runs,
+               format_duration(percentile(stats, 50), p50, sizeof(p50)),
+               format_duration(percentile(stats, 95), p95, sizeof(p95)),
+               format_duration(percentile(stats, 99), p99, sizeof(p99)),
+               format_duration(stats->total_us, total, sizeof(total)));
+    }
+    free(sorted);
+}
+
+void print_log_stats(void) {
+    StatsState state = { 0 };
+    log_for_each(collect_entry, &state);
+    if (state.num_slowest == 0) {
+        printf("No commands logged.\n");
+        return;
+    }
+
+    print_slowest(&state);
+    print_per_command(&state);
+
+    for (int i = 0; i < state.num_slowest; i++) {
+        free(state.slowest[i].command);
+    }
+    for (size_t i = 0; i < state.size; i++) {
+        free(state.table[i].name);
+        free(state.table[i].durations);
+    }
+    free(state.table);
+}
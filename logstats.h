@@ -0,0 +1,11 @@
+#ifndef LOGSTATS_H
+#define LOGSTATS_H
+
+#define LOG_STATS_SLOWEST 10  // Slowest commands listed by 'log stats'
+
+// Prints what the logged commands cost: the slowest ones, and for each
+// program the number of runs, the share that failed, the median, 95th and
+// 99th percentile of their durations and the total time spent in it.
+void print_log_stats(void);
+
+#endif // LOGSTATS_H
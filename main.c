@@ -6,6 +6,10 @@
 #include "signal.h"
 #include "custom.h"
 #include "command.h"
+#include "alias.h"
+#include "bench.h"
+#include "launch.h"
+#include "events.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +17,22 @@
 #include <limits.h>
 #include <errno.h>
 
-int main() {
+int main(int argc, char *argv[]) {
+    // Parse-only benchmark: ./a.out --bench-parse <file> [iterations]
+    if (argc > 2 && strcmp(argv[1], "--bench-parse") == 0) {
+        return bench_parse(argv[2], argc > 3 ? atoi(argv[3]) : 1000);
+    }
+    // Launch benchmark: ./a.out --bench-spawn [program] [iterations] [ballast_mb]
+    if (argc > 1 && strcmp(argv[1], "--bench-spawn") == 0) {
+        return bench_spawn(argc > 2 ? argv[2] : "true", argc > 3 ? atoi(argv[3]) : 1000,
+                           argc > 4 ? atoi(argv[4]) : 0);
+    }
+
+    // SHELL_LAUNCH=spawn|vfork|fork picks how programs are started
+    const char *strategy = getenv("SHELL_LAUNCH");
+    if (strategy != NULL && parse_launch_strategy(strategy) >= 0) {
+        launch_strategy = parse_launch_strategy(strategy);
+    }
 
     char home_dir[MAX_PATH_LENGTH];
     if (getcwd(home_dir, sizeof(home_dir)) == NULL) {
@@ -28,23 +47,17 @@ int main() {
     // Initialize log tracking with home directory
     set_log_directory(home_dir);
     init_log();
-    setup_signal_handlers();
+    // Signals and finished jobs are handled while waiting for input or for
+    // foreground commands, never from inside a signal handler
+    events_init();
 
     while (1) {
         display_prompt(home_dir);
 
-        char command[256];
-        if (fgets(command, sizeof(command), stdin) == NULL) {
-            // Check if fgets returns NULL due to EOF (Ctrl-D)
-            if (feof(stdin)) {
-                handle_sigquit(SIGQUIT);  // Handle Ctrl-D by logging out
-            } else {
-                perror(RED "Error reading input" RESET);
-                exit(EXIT_FAILURE);
-            }
+        char *command = events_read_line();
+        if (command == NULL) {
+            handle_sigquit(SIGQUIT);  // Handle Ctrl-D by logging out
         }
-        // Remove the newline character from input
-        command[strcspn(command, "\n")] = '\0';
 
         // Process the command
         process_command(command, home_dir);
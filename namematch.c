@@ -0,0 +1,314 @@
+#include "namematch.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void name_matcher_add(NameMatcher *matcher, NamePatternKind kind, const char *pattern) {
+    char **patterns = realloc(matcher->patterns, (matcher->num_patterns + 1) * sizeof(char *));
+    NamePatternKind *kinds = realloc(matcher->kinds, (matcher->num_patterns + 1) * sizeof(NamePatternKind));
+    if (patterns != NULL) matcher->patterns = patterns;
+    if (kinds != NULL) matcher->kinds = kinds;
+    if (patterns == NULL || kinds == NULL) {
+        perror(RED "realloc failed" RESET);
+        return;
+    }
+    matcher->patterns[matcher->num_patterns] = strdup(pattern);
+    matcher->kinds[matcher->num_patterns++] = kind;
+}
+
+// Builds the automaton: a trie of the substrings whose missing transitions
+// are filled in from the failure links, breadth first
+static int build_automaton(NameMatcher *matcher) {
+    size_t max_states = 1;
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        if (matcher->kinds[i] == NAME_SUBSTRING) {
+            max_states += strlen(matcher->patterns[i]);
+        }
+    }
+    matcher->delta = calloc(max_states * 256, sizeof(uint32_t));
+    matcher->accept = calloc(max_states, 1);
+    uint32_t *fail = calloc(max_states, sizeof(uint32_t));
+    uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+    if (matcher->delta == NULL || matcher->accept == NULL || fail == NULL || queue == NULL) {
+        perror(RED "malloc failed" RESET);
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    // The trie; 0 is both the root and "no transition yet"
+    uint32_t num_states = 1;
+    int first_seen[256] = { 0 };
+    matcher->num_first_bytes = 0;
+    int prefilter = 1;
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        const unsigned char *pattern = (const unsigned char *)matcher->patterns[i];
+        if (matcher->kinds[i] != NAME_SUBSTRING) {
+            continue;
+        }
+        if (pattern[0] == '\0') {
+            matcher->accept[0] = 1;  // Matches every name
+            prefilter = 0;
+            continue;
+        }
+        if (!first_seen[pattern[0]]) {
+            first_seen[pattern[0]] = 1;
+            if (matcher->num_first_bytes < NAME_PREFILTER_BYTES) {
+                matcher->first_bytes[matcher->num_first_bytes] = pattern[0];
+            }
+            matcher->num_first_bytes++;
+        }
+        uint32_t state = 0;
+        for (; *pattern != '\0'; pattern++) {
+            uint32_t *next = &matcher->delta[state * 256 + *pattern];
+            if (*next == 0) {
+                *next = num_states++;
+            }
+            state = *next;
+        }
+        matcher->accept[state] = 1;
+    }
+    if (!prefilter || matcher->num_first_bytes > NAME_PREFILTER_BYTES) {
+        matcher->num_first_bytes = 0;
+    }
+
+    // Breadth first, every state's failure link is already final when it is
+    // reached, so its missing transitions can be copied from there
+    size_t head = 0, tail = 0;
+    for (int c = 0; c < 256; c++) {
+        if (matcher->delta[c] != 0) {
+            queue[tail++] = matcher->delta[c];  // Failure link: the root
+        }
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        matcher->accept[state] |= matcher->accept[fail[state]];
+        for (int c = 0; c < 256; c++) {
+            uint32_t *next = &matcher->delta[state * 256 + c];
+            uint32_t fallback = matcher->delta[fail[state] * 256 + c];
+            if (*next != 0) {
+                fail[*next] = fallback;
+                queue[tail++] = *next;
+            } else {
+                *next = fallback;
+            }
+        }
+    }
+    matcher->num_states = num_states;
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// The ']' closing the bracket expression that starts at p (a ']' right
+// after the '[' or its negation is part of the set), or NULL if there is none
+static const char *bracket_end(const char *p) {
+    p++;
+    if (*p == '!' || *p == '^') p++;
+    if (*p == ']') p++;
+    return strchr(p, ']');
+}
+
+// Appends a glob as the equivalent extended regular expression
+static void append_glob(char *out, size_t *length, const char *glob) {
+    for (const char *p = glob; *p != '\0'; p++) {
+        if (*p == '*') {
+            out[(*length)++] = '.';
+            out[(*length)++] = '*';
+        } else if (*p == '?') {
+            out[(*length)++] = '.';
+        } else if (*p == '[' && bracket_end(p) != NULL) {
+            // A bracket expression means the same, except for negation
+            const char *end = bracket_end(p);
+            out[(*length)++] = '[';
+            p++;
+            if (*p == '!' || *p == '^') {
+                out[(*length)++] = '^';
+                p++;
+            }
+            while (p < end) out[(*length)++] = *p++;
+            out[(*length)++] = ']';
+        } else {
+            if (strchr(".^$+(){}|\\[]", *p) != NULL) {
+                out[(*length)++] = '\\';
+            }
+            out[(*length)++] = *p;
+        }
+    }
+}
+
+// Compiles every glob and regular expression into one anchored alternation
+static int build_regex(NameMatcher *matcher, int workers) {
+    size_t size = 16;
+    int count = 0;
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        if (matcher->kinds[i] == NAME_GLOB || matcher->kinds[i] == NAME_REGEX) {
+            size += 2 * strlen(matcher->patterns[i]) + 4;
+            count++;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    char *expression = malloc(size);
+    if (expression == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    size_t length = 0;
+    expression[length++] = '^';
+    expression[length++] = '(';
+    int added = 0;
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        if (matcher->kinds[i] != NAME_GLOB && matcher->kinds[i] != NAME_REGEX) {
+            continue;
+        }
+        if (added++ > 0) expression[length++] = '|';
+        expression[length++] = '(';
+        if (matcher->kinds[i] == NAME_GLOB) {
+            append_glob(expression, &length, matcher->patterns[i]);
+        } else {
+            memcpy(expression + length, matcher->patterns[i], strlen(matcher->patterns[i]));
+            length += strlen(matcher->patterns[i]);
+        }
+        expression[length++] = ')';
+    }
+    expression[length++] = ')';
+    expression[length++] = '$';
+    expression[length] = '\0';
+
+    matcher->regexes = calloc(workers, sizeof(regex_t));
+    if (matcher->regexes == NULL) {
+        perror(RED "malloc failed" RESET);
+        free(expression);
+        return -1;
+    }
+    for (; matcher->num_regexes < workers; matcher->num_regexes++) {
+        int error = regcomp(&matcher->regexes[matcher->num_regexes], expression, REG_EXTENDED | REG_NOSUB);
+        if (error != 0) {
+            char message[256];
+            regerror(error, &matcher->regexes[matcher->num_regexes], message, sizeof(message));
+            fprintf(stderr, RED "Invalid pattern: %s\n" RESET, message);
+            free(expression);
+            return -1;
+        }
+    }
+    free(expression);
+    return 0;
+}
+
+int name_matcher_compile(NameMatcher *matcher, int workers) {
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        if (matcher->patterns[i] == NULL) {
+            perror(RED "malloc failed" RESET);
+            return -1;
+        }
+    }
+    int num_exact = 0;
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        num_exact += (matcher->kinds[i] == NAME_EXACT);
+    }
+    matcher->exact = malloc((num_exact + 1) * sizeof(char *));
+    if (matcher->exact == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        if (matcher->kinds[i] == NAME_EXACT) {
+            matcher->exact[matcher->num_exact++] = matcher->patterns[i];
+        }
+    }
+    qsort(matcher->exact, matcher->num_exact, sizeof(char *), compare_strings);
+
+    if (build_automaton(matcher) != 0 || build_regex(matcher, workers) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// The first byte that some substring starts with, or NULL if there is none
+static const char *find_first_byte(const NameMatcher *matcher, const char *text, size_t length) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i bytes[NAME_PREFILTER_BYTES];
+    for (int b = 0; b < matcher->num_first_bytes; b++) {
+        bytes[b] = _mm_set1_epi8((char)matcher->first_bytes[b]);
+    }
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i hits = _mm_cmpeq_epi8(chunk, bytes[0]);
+        for (int b = 1; b < matcher->num_first_bytes; b++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, bytes[b]));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return text + i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        if (memchr(matcher->first_bytes, text[i], matcher->num_first_bytes) != NULL) {
+            return text + i;
+        }
+    }
+    return NULL;
+}
+
+static int match_substrings(const NameMatcher *matcher, const char *name, size_t length) {
+    if (matcher->accept[0]) {
+        return 1;
+    }
+    uint32_t state = 0;
+    size_t i = 0;
+    while (i < length) {
+        // Back at the root, nothing can match before the next first byte
+        if (state == 0 && matcher->num_first_bytes > 0) {
+            const char *next = find_first_byte(matcher, name + i, length - i);
+            if (next == NULL) {
+                return 0;
+            }
+            i = next - name;
+        }
+        state = matcher->delta[state * 256 + (unsigned char)name[i++]];
+        if (matcher->accept[state]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int name_matcher_match(const NameMatcher *matcher, int worker, const char *name, size_t length) {
+    if (matcher->num_states > 1 || (matcher->accept != NULL && matcher->accept[0])) {
+        if (match_substrings(matcher, name, length)) {
+            return 1;
+        }
+    }
+    if (matcher->num_exact > 0 && bsearch(&name, matcher->exact, matcher->num_exact, sizeof(char *), compare_strings) != NULL) {
+        return 1;
+    }
+    return matcher->num_regexes > 0 && regexec(&matcher->regexes[worker], name, 0, NULL, 0) == 0;
+}
+
+void name_matcher_clear(NameMatcher *matcher) {
+    for (int i = 0; i < matcher->num_patterns; i++) {
+        free(matcher->patterns[i]);
+    }
+    for (int i = 0; i < matcher->num_regexes; i++) {
+        regfree(&matcher->regexes[i]);
+    }
+    free(matcher->patterns);
+    free(matcher->kinds);
+    free(matcher->delta);
+    free(matcher->accept);
+    free(matcher->exact);
+    free(matcher->regexes);
+    memset(matcher, 0, sizeof(*matcher));
+}
@@ -0,0 +1,52 @@
+#ifndef NAMEMATCH_H
+#define NAMEMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <regex.h>
+
+#define NAME_PREFILTER_BYTES 8  // Most distinct first bytes the SIMD prefilter looks for
+
+typedef enum NamePatternKind {
+    NAME_SUBSTRING,       // Occurs anywhere in the name
+    NAME_EXACT,           // Is the whole name
+    NAME_GLOB,            // Shell wildcards (*, ? and [...]) matching the whole name
+    NAME_REGEX            // Extended regular expression matching the whole name
+} NamePatternKind;
+
+// Any number of patterns of every kind, compiled into one matcher: the
+// substrings into an Aho-Corasick automaton, the exact names into a sorted
+// array and the globs and regular expressions into a single regex.
+// Zero-initialize, add patterns, compile, then match from any thread.
+typedef struct NameMatcher {
+    // Patterns as added
+    char **patterns;
+    NamePatternKind *kinds;
+    int num_patterns;
+
+    // Aho-Corasick automaton of the substrings, as a full transition table
+    uint32_t *delta;      // delta[state * 256 + byte]
+    uint8_t *accept;      // Non-zero if some substring ends in this state
+    uint32_t num_states;
+    unsigned char first_bytes[NAME_PREFILTER_BYTES];
+    int num_first_bytes;  // 0 if there are too many to prefilter
+
+    const char **exact;   // Sorted
+    int num_exact;
+
+    regex_t *regexes;     // One copy per worker, since glibc serializes regexec on a regex_t
+    int num_regexes;
+} NameMatcher;
+
+void name_matcher_add(NameMatcher *matcher, NamePatternKind kind, const char *pattern);
+
+// Builds the matcher for use by worker threads (0 to workers - 1). Returns
+// -1 after printing why if a regular expression is invalid.
+int name_matcher_compile(NameMatcher *matcher, int workers);
+
+// Whether name (NUL-terminated, length bytes long) matches any of the patterns
+int name_matcher_match(const NameMatcher *matcher, int worker, const char *name, size_t length);
+
+void name_matcher_clear(NameMatcher *matcher);
+
+#endif // NAMEMATCH_H
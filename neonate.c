@@ -1,4 +1,5 @@
 #include "neonate.h"
+#include "events.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -16,6 +17,30 @@ static void restore_terminal_mode(void) {
     }
 }
 
+// Timer callback: prints the pid of the most recently created process
+static void print_last_pid(void *arg) {
+    FILE *f = fopen("/proc/sys/kernel/ns_last_pid", "r");
+    if (!f) {
+        perror(RED "Failed to open /proc/sys/kernel/ns_last_pid" RESET);
+        return;
+    }
+    char buffer[15];
+    if (fgets(buffer, 15, f)) {
+        printf("%s\n", buffer);
+    }
+    fclose(f);
+}
+
+// Input callback: stops neonate once 'x' is pressed (or input ends)
+static void read_key(void *arg) {
+    int *done = arg;
+    char input_char;
+    ssize_t got = read(STDIN_FILENO, &input_char, 1);
+    if (got <= 0 || input_char == 'x') {
+        *done = 1;
+    }
+}
+
 void neonate(int interval) {
     // Set terminal to print mode
     if (tcgetattr(STDIN_FILENO, &original) == -1) {
@@ -32,32 +57,19 @@ void neonate(int interval) {
 
     atexit(restore_terminal_mode);
 
-    pid_t child_pid = fork();
-    if (child_pid == 0) {
-        while (1) {
-            FILE *f = fopen("/proc/sys/kernel/ns_last_pid", "r");
-            if (!f) {
-                perror(RED "Failed to open /proc/sys/kernel/ns_last_pid" RESET);
-                exit(EXIT_FAILURE);
-            }
-            char buffer[15];
-            if (fgets(buffer, 15, f)) {
-                printf("%s\n", buffer);
-            }
-            fclose(f);
-            sleep(interval);
-        }
-    } else if (child_pid > 0) {
-        char input_char;
-        while (read(STDIN_FILENO, &input_char, 1) == 1 && input_char != 'x')
-            continue;
-        restore_terminal_mode();
-        if (kill(child_pid, SIGKILL) == -1) {
-            perror(RED "Failed to kill child process" RESET);
-            exit(EXIT_FAILURE);
-        }
-    } else {
-        perror(RED "Fork failed" RESET);
-        exit(EXIT_FAILURE);
+    // The shell's event loop runs both the timer and the keyboard, so no
+    // printer process has to be forked and killed
+    int done = 0;
+    print_last_pid(NULL);
+    int timer = events_add_timer(interval * 1000, print_last_pid, NULL);
+    if (timer < 0 || events_watch_fd(STDIN_FILENO, read_key, &done) != 0) {
+        done = 1;
+    }
+    events_run_until(&done);
+
+    events_unwatch_fd(STDIN_FILENO);
+    if (timer >= 0) {
+        events_remove_timer(timer);
     }
+    restore_terminal_mode();
 }
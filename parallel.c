@@ -0,0 +1,336 @@
+#define _GNU_SOURCE  // pipe2
+#include "parallel.h"
+#include "command.h"
+#include "events.h"
+#include "jobs.h"
+#include "parser.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// One input line and what became of it
+typedef struct ParallelJob {
+    const char *name;     // Program name, for a job that is stopped
+    pid_t pid;            // -1 if it could not be started
+    int out_fd;           // Read end of the pipe its output goes to, -1 once closed
+    char *output;         // Captured output that was not printed yet
+    size_t length;
+    size_t capacity;
+    int finished;
+} ParallelJob;
+
+// Jobs in input order. Callbacks refer to them by index, since the array
+// moves when it grows.
+static ParallelJob *jobs;
+static int num_jobs;
+static int jobs_capacity;
+static int next_to_print;  // With -k: the oldest job whose output is not printed yet
+static int keep_order;
+
+// Buffered reader for the input lines
+typedef struct LineReader {
+    int fd;
+    char *buffer;
+    size_t capacity;
+    size_t start;         // First byte not returned yet
+    size_t end;
+    int eof;
+} LineReader;
+
+// Returns the next line without its newline (valid until the next call),
+// or NULL at end of input
+static char *next_line(LineReader *reader) {
+    while (1) {
+        char *newline = (reader->start < reader->end)
+                      ? memchr(reader->buffer + reader->start, '\n', reader->end - reader->start)
+                      : NULL;
+        if (newline != NULL || (reader->eof && reader->start < reader->end)) {
+            char *line = reader->buffer + reader->start;
+            if (newline == NULL) {
+                newline = reader->buffer + reader->end;  // Room was kept for this
+            }
+            *newline = '\0';
+            reader->start = newline - reader->buffer + 1;
+            if (reader->start > reader->end) reader->start = reader->end;
+            return line;
+        }
+        if (reader->eof) {
+            return NULL;
+        }
+
+        // Keep the partial line and make room after it (plus one byte for a terminator)
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        if (reader->end + 1 >= reader->capacity) {
+            size_t capacity = (reader->capacity == 0) ? 4096 : reader->capacity * 2;
+            char *grown = realloc(reader->buffer, capacity);
+            if (grown == NULL) {
+                perror(RED "realloc failed" RESET);
+                return NULL;
+            }
+            reader->buffer = grown;
+            reader->capacity = capacity;
+        }
+
+        ssize_t got = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end - 1);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            perror(RED "Error reading input" RESET);
+        }
+        if (got <= 0) {
+            reader->eof = 1;
+        } else {
+            reader->end += got;
+        }
+    }
+}
+
+static void print_output(ParallelJob *job) {
+    if (job->length > 0) {
+        fwrite(job->output, 1, job->length, stdout);
+        fflush(stdout);
+    }
+    job->length = 0;
+}
+
+static void close_output(ParallelJob *job) {
+    if (job->out_fd >= 0) {
+        events_unwatch_fd(job->out_fd);
+        close(job->out_fd);
+        job->out_fd = -1;
+    }
+}
+
+// Input callback: moves whatever a job has written into its buffer
+static void capture_output(void *arg) {
+    int index = (intptr_t)arg;
+    ParallelJob *job = &jobs[index];
+    while (job->out_fd >= 0) {
+        if (job->capacity - job->length < 4096) {
+            size_t capacity = (job->capacity == 0) ? 8192 : job->capacity * 2;
+            char *grown = realloc(job->output, capacity);
+            if (grown == NULL) {
+                perror(RED "realloc failed" RESET);
+                close_output(job);
+                break;
+            }
+            job->output = grown;
+            job->capacity = capacity;
+        }
+        ssize_t got = read(job->out_fd, job->output + job->length, job->capacity - job->length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && errno == EAGAIN) break;
+        if (got <= 0) {
+            close_output(job);  // End of output (or an error that ends it)
+            break;
+        }
+        job->length += got;
+    }
+
+    // Everything before the oldest unfinished job is printed, so with -k its
+    // output can go straight through instead of piling up
+    if (keep_order && index == next_to_print) {
+        print_output(job);
+    }
+}
+
+static ParallelJob *new_job(void) {
+    if (num_jobs == jobs_capacity) {
+        int capacity = (jobs_capacity == 0) ? 64 : jobs_capacity * 2;
+        ParallelJob *grown = realloc(jobs, capacity * sizeof(ParallelJob));
+        if (grown == NULL) {
+            perror(RED "realloc failed" RESET);
+            return NULL;
+        }
+        jobs = grown;
+        jobs_capacity = capacity;
+    }
+    ParallelJob *job = &jobs[num_jobs++];
+    memset(job, 0, sizeof(*job));
+    job->pid = -1;
+    job->out_fd = -1;
+    return job;
+}
+
+// Turns an input line into the command list it stands for
+static CommandList *job_command(const ParallelOptions *options, const char *line, ShellContext *ctx) {
+    if (options->command == NULL) {
+        return parse_command_line(line, ctx->arena);
+    }
+
+    SimpleCommand *cmd = arena_alloc(ctx->arena, sizeof(SimpleCommand));
+    Pipeline *pipeline = arena_alloc(ctx->arena, sizeof(Pipeline));
+    CommandList *list = arena_alloc(ctx->arena, sizeof(CommandList));
+    memset(cmd, 0, sizeof(*cmd));
+    memset(pipeline, 0, sizeof(*pipeline));
+    cmd->argc = options->command_argc + 1;
+    cmd->argv = arena_alloc(ctx->arena, (cmd->argc + 1) * sizeof(char *));
+    memcpy(cmd->argv, options->command, options->command_argc * sizeof(char *));
+    cmd->argv[cmd->argc - 1] = arena_strdup(ctx->arena, line);
+    cmd->argv[cmd->argc] = NULL;
+    pipeline->num_commands = 1;
+    pipeline->commands = cmd;
+    list->num_pipelines = 1;
+    list->pipelines = pipeline;
+    return list;
+}
+
+// Starts the job for one line with its output going to a pipe of its own.
+// Returns its pid, or -1 if it could not be started.
+static pid_t start_job(const ParallelOptions *options, const char *line, int null_fd, ShellContext *ctx) {
+    ParallelJob *job = new_job();
+    if (job == NULL) {
+        return -1;
+    }
+    int index = num_jobs - 1;
+    job->finished = 1;  // Until it has actually started
+
+    CommandList *list = job_command(options, line, ctx);
+    if (list == NULL || list->num_pipelines == 0) {
+        return -1;
+    }
+    job->name = list->pipelines[0].commands[0].argv[0];
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror(RED "Pipe creation failed" RESET);
+        return -1;
+    }
+    pid_t pid = start_command_list(list, ctx->home_dir, null_fd, fds[1]);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    job->pid = pid;
+    job->finished = 0;
+    job->out_fd = fds[0];
+    fcntl(job->out_fd, F_SETFL, O_NONBLOCK);
+    if (events_watch_fd(job->out_fd, capture_output, (void *)(intptr_t)index) != 0) {
+        perror(RED "Error watching job output" RESET);
+    }
+    return pid;
+}
+
+// Prints the output of every finished job that is next in line
+static void print_finished_in_order(void) {
+    while (next_to_print < num_jobs && jobs[next_to_print].finished) {
+        print_output(&jobs[next_to_print++]);
+    }
+    if (next_to_print < num_jobs) {
+        print_output(&jobs[next_to_print]);  // Now at the front: catch up
+    }
+}
+
+static void finish_job(int index, int status) {
+    ParallelJob *job = &jobs[index];
+    // Whatever it wrote before exiting is still in the pipe
+    capture_output((void *)(intptr_t)index);
+    close_output(job);
+    job->finished = 1;
+
+    if (WIFSTOPPED(status)) {
+        // Like any foreground command it becomes a job; its output so far is kept
+        printf("Stopped foreground process PID: %d\n", job->pid);
+        add_process(job->pid, job->name);
+        set_process_state(job->pid, JOB_STOPPED);
+    }
+    if (!keep_order) {
+        print_output(job);
+    } else {
+        print_finished_in_order();
+    }
+}
+
+static int job_failed(int status) {
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int run_parallel(const ParallelOptions *options, ShellContext *ctx) {
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pid_t *pids = malloc(options->max_jobs * sizeof(pid_t));
+    int *slots = malloc(options->max_jobs * sizeof(int));
+    int *statuses = malloc(options->max_jobs * sizeof(int));
+    if (null_fd < 0 || pids == NULL || slots == NULL || statuses == NULL) {
+        perror(RED "parallel" RESET);
+        if (null_fd >= 0) close(null_fd);
+        free(pids);
+        free(slots);
+        free(statuses);
+        return 1;
+    }
+
+    num_jobs = 0;
+    next_to_print = 0;
+    keep_order = options->keep_order;
+    LineReader reader = { options->input_fd };
+    int running = 0;
+    int failed = 0;
+    int interrupted = 0;
+
+    while (1) {
+        // Fill every free slot before waiting
+        char *line;
+        while (!interrupted && running < options->max_jobs && (line = next_line(&reader)) != NULL) {
+            while (isspace((unsigned char)*line)) line++;
+            if (*line == '\0') continue;
+
+            pid_t pid = start_job(options, line, null_fd, ctx);
+            if (pid < 0) {
+                failed++;
+                if (keep_order) print_finished_in_order();
+                continue;
+            }
+            pids[running] = pid;
+            slots[running++] = num_jobs - 1;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        for (int i = 0; i < running; i++) {
+            statuses[i] = -1;  // Never a real wait status
+        }
+        events_wait_any(pids, running, statuses);
+        for (int i = 0; i < running; i++) {
+            if (statuses[i] == -1) continue;
+            finish_job(slots[i], statuses[i]);
+            failed += job_failed(statuses[i]);
+            // Ctrl-C reaches the jobs directly; it also ends the queue
+            if (WIFSIGNALED(statuses[i]) && WTERMSIG(statuses[i]) == SIGINT) {
+                interrupted = 1;
+            }
+            running--;
+            pids[i] = pids[running];
+            slots[i] = slots[running];
+            statuses[i] = statuses[running];
+            i--;
+        }
+    }
+
+    if (failed > 0) {
+        fprintf(stderr, RED "parallel: %d of %d jobs failed\n" RESET, failed, num_jobs);
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        free(jobs[i].output);
+    }
+    free(jobs);
+    jobs = NULL;
+    num_jobs = jobs_capacity = 0;
+    free(reader.buffer);
+    free(pids);
+    free(slots);
+    free(statuses);
+    close(null_fd);
+    return failed > 0;
+}
@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "builtin.h"
+
+typedef struct ParallelOptions {
+    int max_jobs;         // Most jobs running at once (-j)
+    int keep_order;       // 1 to print output in input order (-k)
+    int input_fd;         // Lines are read from here, one job per line
+    char **command;       // Each line is appended to this as one argument,
+    int command_argc;     // or, if it is NULL, run as a command line itself
+} ParallelOptions;
+
+// Runs one job per input line with at most max_jobs of them at a time,
+// starting the next as soon as one finishes. Each job's output is captured
+// and printed in one piece once it is done. Returns 1 if any job failed.
+int run_parallel(const ParallelOptions *options, ShellContext *ctx);
+
+#endif // PARALLEL_H
@@ -0,0 +1,336 @@
+#include "parser.h"
+#include "color.h"
+#include "arena.h"
+#include "alias.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum TokenType {
+    TOK_WORD,
+    TOK_PIPE,      // |
+    TOK_FANOUT,    // |+
+    TOK_LPAREN,    // (
+    TOK_RPAREN,    // )
+    TOK_AMP,       // &
+    TOK_SEMI,      // ;
+    TOK_IN,        // <
+    TOK_OUT,       // >
+    TOK_APPEND,    // >>
+    TOK_END,
+    TOK_ERROR
+} TokenType;
+
+#define MAX_ALIAS_DEPTH 16  // Longest chain of aliases expanding to other aliases
+
+// Where to continue once the text of an expanded alias has been lexed
+typedef struct AliasFrame {
+    const char *name;     // Alias being expanded, used to detect cycles
+    const char *resume;   // Position in the enclosing text after the alias
+    char *out;            // Word storage of the enclosing text
+} AliasFrame;
+
+typedef struct Parser {
+    Arena *arena;         // Every node of the tree is allocated from here
+    const char *pos;      // Next unread character of the text being lexed
+    char *out;            // Next free byte in the word storage
+    TokenType type;       // Current (lookahead) token
+    char *word;           // Text of the current token if it is a TOK_WORD
+    int quoted;           // 1 if the current word contained quotes or escapes
+    int depth;            // Number of active alias expansions
+    AliasFrame aliases[MAX_ALIAS_DEPTH];
+} Parser;
+
+static int is_operator_char(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Reads one word starting at p->pos, removing quotes and backslash escapes.
+// The unquoted text is written to the word storage, which is sized so that it
+// can never overflow (every word is at most as long as its source text).
+static TokenType lex_word(Parser *p) {
+    const char *s = p->pos;
+    char *w = p->out;
+    p->word = w;
+    p->quoted = 0;
+
+    while (*s != '\0' && !is_blank(*s) && !is_operator_char(*s)) {
+        if (*s == '\'') {
+            p->quoted = 1;
+            s++;
+            while (*s != '\0' && *s != '\'') *w++ = *s++;
+            if (*s == '\0') {
+                fprintf(stderr, RED "Syntax error: unterminated quote\n" RESET);
+                return TOK_ERROR;
+            }
+            s++;
+        } else if (*s == '"') {
+            p->quoted = 1;
+            s++;
+            while (*s != '\0' && *s != '"') {
+                if (*s == '\\' && (s[1] == '"' || s[1] == '\\')) s++;
+                *w++ = *s++;
+            }
+            if (*s == '\0') {
+                fprintf(stderr, RED "Syntax error: unterminated quote\n" RESET);
+                return TOK_ERROR;
+            }
+            s++;
+        } else if (*s == '\\' && s[1] != '\0') {
+            p->quoted = 1;
+            s++;
+            *w++ = *s++;
+        } else {
+            *w++ = *s++;
+        }
+    }
+
+    *w++ = '\0';
+    p->out = w;
+    p->pos = s;
+    return TOK_WORD;
+}
+
+// Advances to the next token
+static void next_token(Parser *p) {
+    const char *s = p->pos;
+    while (1) {
+        while (is_blank(*s)) s++;
+        if (*s != '\0' || p->depth == 0) break;
+        // End of an alias's text: carry on after the alias in the enclosing text
+        AliasFrame *frame = &p->aliases[--p->depth];
+        s = frame->resume;
+        p->out = frame->out;
+    }
+    p->pos = s;
+    p->word = NULL;
+
+    switch (*s) {
+        case '\0':
+            p->type = TOK_END;
+            return;
+        case '|':
+            if (s[1] == '+') {
+                p->type = TOK_FANOUT;
+                p->pos = s + 2;
+                return;
+            }
+            p->type = TOK_PIPE;
+            break;
+        case '(':
+            p->type = TOK_LPAREN;
+            break;
+        case ')':
+            p->type = TOK_RPAREN;
+            break;
+        case '&':
+            p->type = TOK_AMP;
+            break;
+        case ';':
+            p->type = TOK_SEMI;
+            break;
+        case '<':
+            p->type = TOK_IN;
+            break;
+        case '>':
+            if (s[1] == '>') {
+                p->type = TOK_APPEND;
+                p->pos = s + 2;
+                return;
+            }
+            p->type = TOK_OUT;
+            break;
+        default:
+            p->type = lex_word(p);
+            return;
+    }
+    p->pos = s + 1;
+}
+
+// If the current word is an unquoted alias that is not already being expanded,
+// switches the lexer to the alias text and returns 1.
+static int expand_alias(Parser *p) {
+    if (p->quoted) return 0;
+    const char *value = find_alias(p->word);
+    if (value == NULL) return 0;
+
+    for (int i = 0; i < p->depth; i++) {
+        if (strcmp(p->aliases[i].name, p->word) == 0) {
+            return 0;  // Recursive use of an alias names the real command
+        }
+    }
+    if (p->depth == MAX_ALIAS_DEPTH) {
+        fprintf(stderr, RED "Alias expansion too deep: %s\n" RESET, p->word);
+        return 0;
+    }
+
+    AliasFrame *frame = &p->aliases[p->depth++];
+    frame->name = p->word;
+    frame->resume = p->pos;
+    frame->out = p->out;
+
+    // Words of the alias text get their own storage, sized like the line's
+    p->pos = value;
+    p->out = arena_alloc(p->arena, 2 * strlen(value) + 2);
+    return 1;
+}
+
+static void *grow_array(Arena *arena, void *array, int *capacity, size_t element_size) {
+    int new_capacity = (*capacity == 0) ? 4 : *capacity * 2;
+    void *grown = arena_grow(arena, array, *capacity * element_size, new_capacity * element_size);
+    *capacity = new_capacity;
+    return grown;
+}
+
+// simple_command := (WORD | redirection)+
+// Returns -2 if no words were found, -1 on any other error.
+static int parse_simple_command(Parser *p, SimpleCommand *cmd) {
+    int capacity = 0;
+    memset(cmd, 0, sizeof(*cmd));
+
+    while (1) {
+        if (p->type == TOK_WORD && cmd->argc == 0 && expand_alias(p)) {
+            next_token(p);
+            continue;
+        }
+        if (p->type == TOK_WORD) {
+            if (cmd->argc + 1 >= capacity) {
+                cmd->argv = grow_array(p->arena, cmd->argv, &capacity, sizeof(char *));
+            }
+            cmd->argv[cmd->argc++] = p->word;
+            cmd->argv[cmd->argc] = NULL;
+        } else if (p->type == TOK_IN || p->type == TOK_OUT || p->type == TOK_APPEND) {
+            TokenType redirect = p->type;
+            next_token(p);
+            if (p->type != TOK_WORD) {
+                if (p->type != TOK_ERROR) {
+                    fprintf(stderr, RED "Syntax error: missing file name after redirection\n" RESET);
+                }
+                return -1;
+            }
+            if (redirect == TOK_IN) {
+                cmd->input_file = p->word;
+            } else {
+                cmd->output_file = p->word;
+                cmd->append = (redirect == TOK_APPEND);
+            }
+        } else {
+            break;
+        }
+        next_token(p);
+    }
+
+    if (p->type == TOK_ERROR) return -1;
+    return (cmd->argc == 0) ? -2 : 0;
+}
+
+static int parse_pipeline(Parser *p, Pipeline *pipeline);
+
+// fanout := '|+' ('(' pipeline ')')+
+// Branches cannot fan out again.
+static int parse_fanout(Parser *p, Pipeline *pipeline) {
+    int capacity = 0;
+    next_token(p);
+    if (p->type != TOK_LPAREN) {
+        fprintf(stderr, RED "Syntax error: expected '(' after '|+'\n" RESET);
+        return -1;
+    }
+
+    while (p->type == TOK_LPAREN) {
+        next_token(p);
+        if (pipeline->num_branches == capacity) {
+            pipeline->branches = grow_array(p->arena, pipeline->branches, &capacity, sizeof(Pipeline));
+        }
+        Pipeline *branch = &pipeline->branches[pipeline->num_branches++];
+        if (parse_pipeline(p, branch) != 0) return -1;
+        if (branch->num_branches > 0) {
+            fprintf(stderr, RED "Syntax error: '|+' cannot be nested\n" RESET);
+            return -1;
+        }
+        if (p->type != TOK_RPAREN) {
+            if (p->type != TOK_ERROR) {
+                fprintf(stderr, RED "Syntax error: missing ')'\n" RESET);
+            }
+            return -1;
+        }
+        next_token(p);
+    }
+    return 0;
+}
+
+// pipeline := simple_command ('|' simple_command)* [fanout]
+static int parse_pipeline(Parser *p, Pipeline *pipeline) {
+    int capacity = 0;
+    memset(pipeline, 0, sizeof(*pipeline));
+
+    while (1) {
+        if (pipeline->num_commands == capacity) {
+            pipeline->commands = grow_array(p->arena, pipeline->commands, &capacity, sizeof(SimpleCommand));
+        }
+        SimpleCommand *cmd = &pipeline->commands[pipeline->num_commands];
+        int status = parse_simple_command(p, cmd);
+        pipeline->num_commands++;
+        if (status == -2) {
+            // A redirection with no command, or an empty side of a '|'
+            if (pipeline->num_commands > 1 || p->type == TOK_PIPE) {
+                fprintf(stderr, RED "Invalid use of pipe\n" RESET);
+            } else {
+                fprintf(stderr, RED "Syntax error: missing command\n" RESET);
+            }
+        }
+        if (status != 0) return -1;
+
+        if (p->type != TOK_PIPE) break;
+        next_token(p);
+    }
+    return (p->type == TOK_FANOUT) ? parse_fanout(p, pipeline) : 0;
+}
+
+// list := pipeline (('&' | ';') pipeline)* ['&' | ';']
+CommandList *parse_command_line(const char *line, Arena *arena) {
+    CommandList *list = arena_alloc(arena, sizeof(CommandList));
+    memset(list, 0, sizeof(*list));
+
+    // Every word is at most as long as its source text plus a terminator
+    char *words = arena_alloc(arena, 2 * strlen(line) + 2);
+
+    Parser p = { arena, line, words, TOK_END, NULL, 0, 0 };
+    int capacity = 0;
+    next_token(&p);
+
+    while (p.type != TOK_END) {
+        if (p.type == TOK_SEMI) {
+            next_token(&p);  // Empty commands between ';' are ignored
+            continue;
+        }
+        if (p.type == TOK_ERROR) return NULL;
+        if (p.type == TOK_AMP || p.type == TOK_PIPE || p.type == TOK_FANOUT || p.type == TOK_RPAREN) {
+            const char *names[] = { [TOK_AMP] = "&", [TOK_PIPE] = "|", [TOK_FANOUT] = "|+", [TOK_RPAREN] = ")" };
+            fprintf(stderr, RED "Syntax error near unexpected token '%s'\n" RESET, names[p.type]);
+            return NULL;
+        }
+
+        if (list->num_pipelines == capacity) {
+            list->pipelines = grow_array(arena, list->pipelines, &capacity, sizeof(Pipeline));
+        }
+        Pipeline *pipeline = &list->pipelines[list->num_pipelines++];
+        if (parse_pipeline(&p, pipeline) != 0) return NULL;
+
+        if (p.type == TOK_AMP) {
+            pipeline->background = 1;
+            next_token(&p);
+        } else if (p.type == TOK_SEMI) {
+            next_token(&p);
+        } else if (p.type != TOK_END) {
+            if (p.type != TOK_ERROR) {
+                fprintf(stderr, RED "Syntax error in command\n" RESET);
+            }
+            return NULL;
+        }
+    }
+    return list;
+}
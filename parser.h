@@ -0,0 +1,35 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "arena.h"
+
+// A single command: its argument vector plus any redirections
+typedef struct SimpleCommand {
+    int argc;
+    char **argv;          // NULL-terminated argument list
+    char *input_file;     // Target of '<', or NULL
+    char *output_file;    // Target of '>' or '>>', or NULL
+    int append;           // 1 if the output redirection was '>>'
+} SimpleCommand;
+
+// One or more simple commands joined by '|', optionally followed by
+// '|+ (branch) (branch) ...' to copy the output to several pipelines
+typedef struct Pipeline {
+    int num_commands;
+    SimpleCommand *commands;
+    int num_branches;           // Number of parenthesised pipelines after '|+'
+    struct Pipeline *branches;  // Each reads its own copy of the output
+    int background;             // 1 if the pipeline was terminated by '&'
+} Pipeline;
+
+// A whole input line: pipelines separated by ';' or '&'
+typedef struct CommandList {
+    int num_pipelines;
+    Pipeline *pipelines;
+} CommandList;
+
+// Parses a command line in a single pass, allocating the whole tree from the
+// arena (it stays valid until the arena is reset). Returns NULL on a syntax error.
+CommandList *parse_command_line(const char *line, Arena *arena);
+
+#endif // PARSER_H
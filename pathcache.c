@@ -0,0 +1,184 @@
+#include "pathcache.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+typedef struct PathEntry {
+    char *name;
+    char *path;           // Absolute location of the program
+    unsigned long hits;   // Lookups answered from the cache
+} PathEntry;
+
+// Open-addressing table keyed by command name, kept at most half full
+static PathEntry *path_table = NULL;
+static size_t path_table_size = 0;
+static size_t path_count = 0;
+static char *cached_path_env = NULL;  // Value of PATH the entries were found with
+
+static uint32_t path_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+static PathEntry *find_slot(PathEntry *table, size_t size, const char *name) {
+    size_t slot = path_hash(name) & (size - 1);
+    while (table[slot].name != NULL && strcmp(table[slot].name, name) != 0) {
+        slot = (slot + 1) & (size - 1);
+    }
+    return &table[slot];
+}
+
+void clear_command_paths(void) {
+    for (size_t i = 0; i < path_table_size; i++) {
+        free(path_table[i].name);
+        free(path_table[i].path);
+    }
+    free(path_table);
+    path_table = NULL;
+    path_table_size = 0;
+    path_count = 0;
+}
+
+// Removes one entry, shifting later entries of its probe run back into place
+static void remove_entry(PathEntry *entry) {
+    free(entry->name);
+    free(entry->path);
+    entry->name = NULL;
+    path_count--;
+
+    size_t hole = entry - path_table;
+    size_t mask = path_table_size - 1;
+    for (size_t slot = (hole + 1) & mask; path_table[slot].name != NULL; slot = (slot + 1) & mask) {
+        size_t home = path_hash(path_table[slot].name) & mask;
+        // Move the entry if the hole lies between its home slot and its slot
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            path_table[hole] = path_table[slot];
+            path_table[slot].name = NULL;
+            hole = slot;
+        }
+    }
+}
+
+static void insert_entry(const char *name, const char *path) {
+    if (2 * (path_count + 1) > path_table_size) {
+        size_t new_size = path_table_size ? path_table_size * 2 : 64;
+        PathEntry *new_table = calloc(new_size, sizeof(PathEntry));
+        if (new_table == NULL) {
+            perror(RED "Error allocating command path cache" RESET);
+            return;
+        }
+        for (size_t i = 0; i < path_table_size; i++) {
+            if (path_table[i].name != NULL) {
+                *find_slot(new_table, new_size, path_table[i].name) = path_table[i];
+            }
+        }
+        free(path_table);
+        path_table = new_table;
+        path_table_size = new_size;
+    }
+
+    PathEntry *entry = find_slot(path_table, path_table_size, name);
+    entry->name = strdup(name);
+    entry->path = strdup(path);
+    entry->hits = 0;
+    if (entry->name == NULL || entry->path == NULL) {
+        perror(RED "Error allocating command path cache" RESET);
+        free(entry->name);
+        free(entry->path);
+        entry->name = NULL;
+        return;
+    }
+    path_count++;
+}
+
+static int is_executable_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walks PATH the way execvp would. Returns 1 and fills found on success;
+// *cacheable is cleared when the match depends on the current directory.
+static int search_path(const char *name, const char *path_env, char *found, int *cacheable) {
+    const char *dir = path_env;
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        int written;
+        if (dir_len == 0) {
+            written = snprintf(found, PATH_MAX, "%s", name);  // Empty entry means "."
+        } else {
+            written = snprintf(found, PATH_MAX, "%.*s/%s", (int)dir_len, dir, name);
+        }
+        if (written < PATH_MAX && is_executable_file(found)) {
+            *cacheable = (found[0] == '/');
+            return 1;
+        }
+
+        if (end == NULL) break;
+        dir = end + 1;
+    }
+    return 0;
+}
+
+const char *lookup_command_path(const char *name) {
+    static char found[PATH_MAX];
+
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    // A different PATH makes every cached location suspect
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "/usr/local/bin:/usr/bin:/bin";
+    }
+    if (cached_path_env == NULL || strcmp(cached_path_env, path_env) != 0) {
+        clear_command_paths();
+        free(cached_path_env);
+        cached_path_env = strdup(path_env);
+    }
+
+    if (path_count > 0) {
+        PathEntry *entry = find_slot(path_table, path_table_size, name);
+        if (entry->name != NULL) {
+            // One access() instead of an execve per PATH directory
+            if (access(entry->path, X_OK) == 0) {
+                entry->hits++;
+                return entry->path;
+            }
+            remove_entry(entry);  // The program moved or was deleted
+        }
+    }
+
+    int cacheable = 0;
+    if (!search_path(name, path_env, found, &cacheable)) {
+        return NULL;
+    }
+    if (cacheable) {
+        insert_entry(name, found);
+    }
+    return found;
+}
+
+void print_command_paths(void) {
+    if (path_count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < path_table_size; i++) {
+        if (path_table[i].name != NULL) {
+            printf("%4lu\t%s\n", path_table[i].hits, path_table[i].path);
+        }
+    }
+}
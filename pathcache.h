@@ -0,0 +1,14 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+// Returns the absolute path of a program, searching PATH only on a cache miss.
+// Names containing '/' are returned unchanged. Returns NULL if not found.
+const char *lookup_command_path(const char *name);
+
+// Forgets every cached location
+void clear_command_paths(void);
+
+// Prints the cached commands with their hit counts and locations
+void print_command_paths(void);
+
+#endif // PATHCACHE_H
@@ -1,9 +1,11 @@
+#define _GNU_SOURCE  // getdents64, statx
 #include "reveal.h"
 #include "color.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <pwd.h>
@@ -14,64 +16,195 @@
 #define PATH_MAX 4096
 static char previous_dir[PATH_MAX] = "";
 
-void print_file_info(const struct stat *file_stat, const char *name) {
-    // Print file type and permissions
-    printf((S_ISDIR(file_stat->st_mode)) ? "d" : "-");
-    printf((file_stat->st_mode & S_IRUSR) ? "r" : "-");
-    printf((file_stat->st_mode & S_IWUSR) ? "w" : "-");
-    printf((file_stat->st_mode & S_IXUSR) ? "x" : "-");
-    printf((file_stat->st_mode & S_IRGRP) ? "r" : "-");
-    printf((file_stat->st_mode & S_IWGRP) ? "w" : "-");
-    printf((file_stat->st_mode & S_IXGRP) ? "x" : "-");
-    printf((file_stat->st_mode & S_IROTH) ? "r" : "-");
-    printf((file_stat->st_mode & S_IWOTH) ? "w" : "-");
-    printf((file_stat->st_mode & S_IXOTH) ? "x " : "- ");
-
-    // Print number of hard links
-    printf("%lu ", file_stat->st_nlink);
-
-    // Print owner and group
-    struct passwd *pw = getpwuid(file_stat->st_uid);
-    struct group *gr = getgrgid(file_stat->st_gid);
-    if (pw == NULL || gr == NULL) {
-        print_error("Error getting file owner or group");
-        return;
+// Only what each format prints is asked of statx
+#define SHORT_MASK (STATX_TYPE | STATX_MODE)
+#define LONG_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME)
+
+// uid or gid -> name, so that a long listing looks each owner up only once.
+// Open addressing, kept at most half full.
+typedef struct IdName {
+    unsigned int id;
+    char *name;           // NULL marks an empty slot
+} IdName;
+
+typedef struct IdCache {
+    IdName *slots;
+    size_t size;
+    size_t used;
+} IdCache;
+
+static IdCache user_names;
+static IdCache group_names;
+
+static size_t id_slot(const IdName *slots, size_t size, unsigned int id) {
+    size_t slot = (id * 2654435761u) & (size - 1);
+    while (slots[slot].name != NULL && slots[slot].id != id) {
+        slot = (slot + 1) & (size - 1);
+    }
+    return slot;
+}
+
+// Returns the name of a user or group, or its number if it has none
+static const char *id_name(IdCache *cache, unsigned int id, bool is_group) {
+    if (cache->size > 0) {
+        IdName *found = &cache->slots[id_slot(cache->slots, cache->size, id)];
+        if (found->name != NULL) {
+            return found->name;
+        }
+    }
+
+    char number[16];
+    const char *name = NULL;
+    if (is_group) {
+        struct group *gr = getgrgid(id);
+        if (gr != NULL) name = gr->gr_name;
+    } else {
+        struct passwd *pw = getpwuid(id);
+        if (pw != NULL) name = pw->pw_name;
+    }
+    if (name == NULL) {
+        snprintf(number, sizeof(number), "%u", id);
+        name = number;
+    }
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        return "?";
     }
-    printf("%s %s ", pw->pw_name, gr->gr_name);
 
-    // Print file size
-    printf("%ld ", file_stat->st_size);
+    if ((cache->used + 1) * 2 > cache->size) {
+        size_t new_size = (cache->size == 0) ? 16 : cache->size * 2;
+        IdName *slots = calloc(new_size, sizeof(IdName));
+        if (slots == NULL) {
+            perror(RED "malloc failed" RESET);
+            free(copy);
+            return "?";
+        }
+        for (size_t i = 0; i < cache->size; i++) {
+            if (cache->slots[i].name != NULL) {
+                slots[id_slot(slots, new_size, cache->slots[i].id)] = cache->slots[i];
+            }
+        }
+        free(cache->slots);
+        cache->slots = slots;
+        cache->size = new_size;
+    }
+    cache->slots[id_slot(cache->slots, cache->size, id)] = (IdName){ id, copy };
+    cache->used++;
+    return copy;
+}
 
-    // Print last modification time
+static const char *name_color(unsigned int mode) {
+    if (S_ISDIR(mode)) {
+        return DIR_COLOR;   // Blue for directories
+    }
+    return (mode & S_IXUSR) ? EXEC_COLOR : FILE_COLOR;  // Green for executables, white otherwise
+}
+
+void print_file_info(const struct statx *file_stat, const char *name) {
+    // File type and permissions
+    static const char bits[] = "rwxrwxrwx";
+    char mode[11];
+    mode[0] = S_ISDIR(file_stat->stx_mode) ? 'd' : '-';
+    for (int i = 0; i < 9; i++) {
+        mode[i + 1] = (file_stat->stx_mode & (S_IRUSR >> i)) ? bits[i] : '-';
+    }
+    mode[10] = '\0';
+
+    // Last modification time
     char time_buff[80];
-    struct tm *tm_info = localtime(&(file_stat->st_mtime));
-    if (tm_info == NULL) {
+    struct tm tm_info;
+    time_t mtime = file_stat->stx_mtime.tv_sec;
+    if (localtime_r(&mtime, &tm_info) == NULL) {
         print_error("Error converting modification time");
         return;
     }
-    strftime(time_buff, sizeof(time_buff), "%b %d %H:%M", tm_info);
-    printf("%s ", time_buff);
+    strftime(time_buff, sizeof(time_buff), "%b %d %H:%M", &tm_info);
 
-    // Print file name with color coding
-    if (S_ISDIR(file_stat->st_mode)) {
-        printf("%s%s%s\n", DIR_COLOR, name, RESET);  // Blue for directories
-    } else if (file_stat->st_mode & S_IXUSR) {
-        printf("%s%s%s\n", EXEC_COLOR, name, RESET);  // Green for executables
-    } else {
-        printf("%s%s%s\n", FILE_COLOR, name, RESET);  // White for regular files
+    printf("%s %u %s %s %llu %s %s%s%s\n", mode, file_stat->stx_nlink,
+           id_name(&user_names, file_stat->stx_uid, false), id_name(&group_names, file_stat->stx_gid, true),
+           (unsigned long long)file_stat->stx_size, time_buff, name_color(file_stat->stx_mode), name, RESET);
+}
+
+// A directory entry; names are kept in one pool while the directory is read
+typedef struct RevealEntry {
+    size_t offset;        // Of the name in the pool
+    const char *name;     // Set once the pool stops moving
+    unsigned char type;   // d_type
+} RevealEntry;
+
+typedef struct RevealListing {
+    RevealEntry *entries;
+    size_t count, capacity;
+    char *names;
+    size_t names_size, names_capacity;
+} RevealListing;
+
+static int add_entry(RevealListing *listing, const char *name, unsigned char type) {
+    size_t length = strlen(name) + 1;
+    if (listing->count == listing->capacity) {
+        size_t capacity = (listing->capacity == 0) ? 256 : listing->capacity * 2;
+        RevealEntry *entries = realloc(listing->entries, capacity * sizeof(RevealEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        listing->entries = entries;
+        listing->capacity = capacity;
     }
+    if (listing->names_size + length > listing->names_capacity) {
+        size_t capacity = (listing->names_capacity == 0) ? 8192 : listing->names_capacity * 2;
+        while (capacity < listing->names_size + length) capacity *= 2;
+        char *names = realloc(listing->names, capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        listing->names = names;
+        listing->names_capacity = capacity;
+    }
+    memcpy(listing->names + listing->names_size, name, length);
+    listing->entries[listing->count++] = (RevealEntry){ listing->names_size, NULL, type };
+    listing->names_size += length;
+    return 0;
+}
+
+// Reads every entry of the directory, REVEAL_DENTS_SIZE bytes of them per
+// getdents64 call
+static int read_entries(int dir_fd, bool show_hidden, RevealListing *listing) {
+    char *buffer = malloc(REVEAL_DENTS_SIZE);
+    if (buffer == NULL) {
+        return -1;
+    }
+    int result = 0;
+    ssize_t got;
+    while (result == 0 && (got = getdents64(dir_fd, buffer, REVEAL_DENTS_SIZE)) != 0) {
+        if (got < 0) {
+            result = -1;
+            break;
+        }
+        for (ssize_t pos = 0; pos < got;) {
+            struct dirent64 *entry = (struct dirent64 *)(buffer + pos);
+            pos += entry->d_reclen;
+            if (!show_hidden && entry->d_name[0] == '.') {
+                continue;
+            }
+            if (add_entry(listing, entry->d_name, entry->d_type) != 0) {
+                result = -1;
+                break;
+            }
+        }
+    }
+    free(buffer);
+    for (size_t i = 0; i < listing->count; i++) {
+        listing->entries[i].name = listing->names + listing->entries[i].offset;
+    }
+    return result;
 }
 
 int compare_entries(const void *a, const void *b) {
-    const struct dirent **entry_a = (const struct dirent **)a;
-    const struct dirent **entry_b = (const struct dirent **)b;
-    return strcmp((*entry_a)->d_name, (*entry_b)->d_name);
+    return strcmp(((const RevealEntry *)a)->name, ((const RevealEntry *)b)->name);
 }
 
 void reveal_command(const char *flags, const char *path, const char *home_dir) {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat file_stat;
+    struct statx file_stat;
 
     char new_dir[PATH_MAX];
     bool show_hidden = false;
@@ -112,7 +245,7 @@ void reveal_command(const char *flags, const char *path, const char *home_dir) {
     }
 
     // Check if the path is a file or directory
-    if (stat(new_dir, &file_stat) == -1) {
+    if (statx(AT_FDCWD, new_dir, 0, LONG_MASK, &file_stat) == -1) {
         print_error("Error getting file status");
         return;
     }
@@ -129,7 +262,7 @@ void reveal_command(const char *flags, const char *path, const char *home_dir) {
         }
     }
 
-    if (S_ISREG(file_stat.st_mode)) {
+    if (S_ISREG(file_stat.stx_mode)) {
         // It's a regular file, print info directly
         if (show_long) {
             print_file_info(&file_stat, path);
@@ -149,55 +282,39 @@ void reveal_command(const char *flags, const char *path, const char *home_dir) {
     previous_dir[sizeof(previous_dir) - 1] = '\0';
 
     // If it's not a regular file, proceed with directory handling
-    if ((dir = opendir(new_dir)) == NULL) {
+    int dir_fd = open(new_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
         print_error("Error opening directory");
         return;
     }
 
-    struct dirent *entries[1024];
-    int count = 0;
-
-    // Read directory entries
-    while ((entry = readdir(dir)) != NULL) {
-        if (!show_hidden && entry->d_name[0] == '.') {
-            continue;
-        }
-
-        if (count < sizeof(entries) / sizeof(entries[0])) {
-            entries[count++] = entry;
-        } else {
-            print_error("Too many entries");
-            break;
-        }
+    RevealListing listing = { 0 };
+    if (read_entries(dir_fd, show_hidden, &listing) != 0) {
+        print_error("Error reading directory");
     }
+    qsort(listing.entries, listing.count, sizeof(RevealEntry), compare_entries);
 
-    qsort(entries, count, sizeof(entries[0]), compare_entries);
-
-    for (int i = 0; i < count; ++i) {
-        char full_path[PATH_MAX];
-        // Ensure the combined length fits in full_path
-        if (snprintf(full_path, sizeof(full_path), "%s/%s", new_dir, entries[i]->d_name) >= sizeof(full_path)) {
-            print_error("Path length exceeds buffer size");
+    // Entries are stat'ed relative to the directory, following links like
+    // stat() would. Without -l a directory needs no stat at all.
+    for (size_t i = 0; i < listing.count; ++i) {
+        const RevealEntry *entry = &listing.entries[i];
+        if (!show_long && entry->type == DT_DIR) {
+            printf("%s%s%s\n", DIR_COLOR, entry->name, RESET);
             continue;
         }
-        
-        if (stat(full_path, &file_stat) == -1) {
+        if (statx(dir_fd, entry->name, 0, show_long ? LONG_MASK : SHORT_MASK, &file_stat) == -1) {
             print_error("Error getting file status");
             continue;
         }
 
         if (show_long) {
-            print_file_info(&file_stat, entries[i]->d_name);
+            print_file_info(&file_stat, entry->name);
         } else {
-            if (S_ISDIR(file_stat.st_mode)) {
-                printf("%s%s%s\n", DIR_COLOR, entries[i]->d_name, RESET);
-            } else if (file_stat.st_mode & S_IXUSR) {
-                printf("%s%s%s\n", EXEC_COLOR, entries[i]->d_name, RESET);
-            } else {
-                printf("%s%s%s\n", FILE_COLOR, entries[i]->d_name, RESET);
-            }
+            printf("%s%s%s\n", name_color(file_stat.stx_mode), entry->name, RESET);
         }
     }
 
-    closedir(dir);
+    free(listing.entries);
+    free(listing.names);
+    close(dir_fd);
 }
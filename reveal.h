@@ -5,6 +5,7 @@
 #include <limits.h>
 
 #define MAX_PATH_LENGTH PATH_MAX
+#define REVEAL_DENTS_SIZE (1 << 20)  // Buffer for one getdents64 call
 
 // Function declaration for the reveal command
 void reveal_command(const char *flags, const char *path, const char *home_dir);
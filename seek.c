@@ -2,17 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include "color.h"
 #include <sys/stat.h>
 #include <unistd.h>
 #include <limits.h>
 #include "seek.h"
+#include "walk.h"
+#include "seekindex.h"
+#include "namematch.h"
+#include "filescan.h"
+#include "copyfd.h"
 
 #define MAX_PATH 1024
 
 // Helper function to print the relative path with appropriate color
-static void print_relative_path(const char *base_dir, const char *path, int is_dir) {
-    const char *relative_path = path + strlen(base_dir) + 1;
+static void print_relative_path(const char *relative_path, int is_dir) {
     if (is_dir) {
         printf("\033[1;34m./%s\033[0m\n", relative_path);  // Blue for directories
     } else {
@@ -54,65 +59,241 @@ static int resolve_path(char *resolved_path, const char *home_dir, const char *p
     return 0;
 }
 
-static int search_directory(const char *base_dir, const char *dir_path, const char *search_term, int show_files, int show_dirs, int exact_match, char *result_path) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        perror(RED "opendir" RESET);
-        return 0;
-    }
+// A match, found by one of the walk's workers
+typedef struct SeekMatch {
+    char *path;           // Relative to the target directory
+    int is_dir;
+    ScanOutput lines;     // With -g: the lines of the file that matched
+} SeekMatch;
 
-    struct dirent *entry;
-    int match_count = 0;
+// The matches of one worker, so that workers never wait for each other
+typedef struct SeekMatches {
+    SeekMatch *matches;
+    size_t count;
+    size_t capacity;
+} SeekMatches;
 
-    while ((entry = readdir(dir)) != NULL) {
-        char path[MAX_PATH];
-        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+typedef struct SeekSearch {
+    const NameMatcher *matcher;
+    int match_names;      // 0 if every name is accepted (-g without name patterns)
+    int show_files;
+    int show_dirs;
+    const char *content;  // With -g: the text to look for inside files
+    FileScanner *scanners; // One per worker
+    SeekMatches *found;   // One list per worker
+    WalkOptions walk;     // --max-depth and the ignore files
+    size_t max_results;   // --max-results, or 0 for no limit
+    size_t max_printed;   // Matches printed, or 0 for all of them
+    size_t num_results;   // Matches kept so far, counted across the workers
+} SeekSearch;
 
-        struct stat statbuf;
-        if (stat(path, &statbuf) == -1) {
-            perror(RED "stat" RESET);
-            continue;
+// Returns the path of the entry relative to the target directory (malloc'd)
+static char *entry_path(const WalkEntry *entry) {
+    size_t dir_length = strlen(entry->dir), name_length = strlen(entry->name);
+    char *path = malloc(dir_length + name_length + 2);
+    if (path == NULL) {
+        perror(RED "malloc failed" RESET);
+        return NULL;
+    }
+    memcpy(path, entry->dir, dir_length);
+    if (dir_length > 0) {
+        path[dir_length++] = '/';
+    }
+    memcpy(path + dir_length, entry->name, name_length + 1);
+    return path;
+}
+
+static void add_match(SeekMatches *list, char *path, int is_dir, ScanOutput lines) {
+    if (list->count == list->capacity) {
+        size_t capacity = (list->capacity == 0) ? 16 : list->capacity * 2;
+        SeekMatch *matches = realloc(list->matches, capacity * sizeof(SeekMatch));
+        if (matches == NULL) {
+            perror(RED "realloc failed" RESET);
+            free(path);
+            free(lines.data);
+            return;
         }
+        list->matches = matches;
+        list->capacity = capacity;
+    }
+    list->matches[list->count++] = (SeekMatch){ path, is_dir, lines };
+}
 
-        int is_match = 0;
-        if (exact_match) {
-            is_match = strcmp(entry->d_name, search_term) == 0;  // Exact match check
-        } else {
-            is_match = strstr(entry->d_name, search_term) != NULL;  // Partial match check
+// Counts count more matches against --max-results. Returns how many of them
+// may still be kept.
+static size_t claim_results(SeekSearch *search, size_t count) {
+    if (search->max_results == 0) {
+        return count;
+    }
+    size_t before = __atomic_fetch_add(&search->num_results, count, __ATOMIC_RELAXED);
+    if (before >= search->max_results) {
+        return 0;
+    }
+    return (count < search->max_results - before) ? count : search->max_results - before;
+}
+
+// The walk stops as soon as enough matches were kept
+static WalkAction next_action(SeekSearch *search) {
+    if (search->max_results != 0 && __atomic_load_n(&search->num_results, __ATOMIC_RELAXED) >= search->max_results) {
+        return WALK_STOP;
+    }
+    return WALK_CONTINUE;
+}
+
+// Looks for the -g text inside a file, on the worker that found it
+static void match_content(SeekSearch *search, const WalkEntry *entry, int worker) {
+    char *path = entry_path(entry);
+    if (path == NULL) {
+        return;
+    }
+    char prefix[PATH_MAX + 3];
+    snprintf(prefix, sizeof(prefix), "./%s", path);
+    ScanOutput lines = { 0 };
+    size_t count = scan_file(&search->scanners[worker], entry->dir_fd, entry->name, search->content,
+                             strlen(search->content), prefix, &lines);
+    size_t kept = claim_results(search, count);
+    if (kept < count && kept > 0) {
+        // Cut the output after the last line that still fits
+        char *end = lines.data;
+        for (size_t i = 0; i < kept; i++) {
+            end = memchr(end, '\n', lines.data + lines.length - end) + 1;
         }
+        lines.length = end - lines.data;
+    }
+    if (kept > 0) {
+        add_match(&search->found[worker], path, 0, lines);
+    } else {
+        free(path);
+        free(lines.data);
+    }
+}
 
-        if (is_match) {
-            if (S_ISDIR(statbuf.st_mode)) {
-                if (show_dirs) {
-                    print_relative_path(base_dir, path, 1);
-                    strcpy(result_path, path);
-                    match_count++;
-                }
-            } else if (S_ISREG(statbuf.st_mode)) {
-                if (show_files) {
-                    print_relative_path(base_dir, path, 0);
-                    strcpy(result_path, path);
-                    match_count++;
-                }
+// Walk callback: runs on the worker threads
+static WalkAction match_entry(const WalkEntry *entry, int worker, void *arg) {
+    SeekSearch *search = arg;
+    if ((entry->type == WALK_DIR && !search->show_dirs) || (entry->type == WALK_FILE && !search->show_files) ||
+        entry->type == WALK_OTHER) {
+        return WALK_CONTINUE;
+    }
+
+    if (search->match_names && !name_matcher_match(search->matcher, worker, entry->name, strlen(entry->name))) {
+        return WALK_CONTINUE;
+    }
+    if (search->content != NULL) {
+        match_content(search, entry, worker);
+        return next_action(search);
+    }
+    if (claim_results(search, 1) == 0) {
+        return WALK_STOP;  // Another worker kept the last one
+    }
+    char *path = entry_path(entry);
+    if (path != NULL) {
+        add_match(&search->found[worker], path, entry->type == WALK_DIR, (ScanOutput){ 0 });
+    }
+    return next_action(search);
+}
+
+static int compare_matches(const void *a, const void *b) {
+    return strcmp(((const SeekMatch *)a)->path, ((const SeekMatch *)b)->path);
+}
+
+// Walks the tree, or looks it up in the name index if it has one, and prints
+// the matches sorted by path, which keeps the output the same however the
+// work was spread over the threads. With --max-results the walk ends once
+// that many were found, so which ones those are depends on the timing.
+// Returns the number of matches and, if there were any, the full path of
+// one in result_path.
+static int search_directory(const char *base_dir, const char *home_dir, SeekSearch *options, char *result_path) {
+    int workers = walk_workers();
+    SeekSearch search = *options;
+    search.found = calloc(workers, sizeof(SeekMatches));
+    search.scanners = calloc(workers, sizeof(FileScanner));
+    if (search.found == NULL || search.scanners == NULL) {
+        perror(RED "malloc failed" RESET);
+        free(search.found);
+        free(search.scanners);
+        return 0;
+    }
+    // File contents are read on the walk's worker threads; the name index
+    // would only hand the files to a single thread
+    if (search.content != NULL || !seek_index_search(base_dir, home_dir, &search.walk, match_entry, &search)) {
+        walk_tree(base_dir, &search.walk, match_entry, &search);
+    }
+    for (int i = 0; i < workers; i++) {
+        file_scanner_clear(&search.scanners[i]);
+    }
+    free(search.scanners);
+
+    size_t total = 0;
+    for (int i = 0; i < workers; i++) {
+        total += search.found[i].count;
+    }
+    SeekMatch *all = malloc((total + 1) * sizeof(SeekMatch));
+    size_t count = 0;
+    for (int i = 0; i < workers; i++) {
+        for (size_t j = 0; j < search.found[i].count; j++) {
+            if (all != NULL) {
+                all[count++] = search.found[i].matches[j];
+            } else {
+                free(search.found[i].matches[j].path);
+                free(search.found[i].matches[j].lines.data);
             }
         }
+        free(search.found[i].matches);
+    }
+    free(search.found);
+    if (all == NULL) {
+        perror(RED "malloc failed" RESET);
+        return 0;
+    }
 
-        // Recursively search subdirectories
-        if (S_ISDIR(statbuf.st_mode) && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-            match_count += search_directory(base_dir, path, search_term, show_files, show_dirs, exact_match, result_path);
+    qsort(all, total, sizeof(SeekMatch), compare_matches);
+    size_t printed = (search.max_printed != 0 && search.max_printed < total) ? search.max_printed : total;
+    for (size_t i = 0; i < printed; i++) {
+        if (search.content != NULL) {
+            fwrite(all[i].lines.data, 1, all[i].lines.length, stdout);
+        } else {
+            print_relative_path(all[i].path, all[i].is_dir);
         }
     }
-
-    closedir(dir);
-    return match_count;
+    if (total > 0) {
+        snprintf(result_path, MAX_PATH, "%s/%s", base_dir, all[total - 1].path);
+    }
+    for (size_t i = 0; i < total; i++) {
+        free(all[i].path);
+        free(all[i].lines.data);
+    }
+    free(all);
+    return total;
 }
 
 void seek_command_handler(char **args, int num_args, char *home_dir) {
     int show_files = 1, show_dirs = 1, exact_match = 0;
+    char *content = NULL;
+    // .seekignore files always apply; --gitignore adds .gitignore files
+    WalkOptions walk = { 0, IGNORE_SEEK };
+    long max_results = 0;
     char resolved_path[MAX_PATH];
     char *search_term = NULL;
     char *target_dir = ".";
 
+    // seek --index [dir] indexes the names below dir for later searches
+    if (strcmp(args[1], "--index") == 0) {
+        if (num_args > 3) {
+            fprintf(stderr, RED "Usage: seek --index [target_directory]\n" RESET);
+        } else if (resolve_path(resolved_path, home_dir, num_args == 3 ? args[2] : ".") == 0) {
+            seek_index_build(resolved_path, home_dir);
+        }
+        return;
+    }
+
+    // Any number of patterns: -p <substring>, --glob <glob>, -r <regex>
+    char **patterns = malloc(num_args * sizeof(char *));
+    NamePatternKind *kinds = malloc(num_args * sizeof(NamePatternKind));
+    int num_patterns = 0;
+    char *positional[2];
+    int num_positional = 0;
+
     // Parse flags and arguments
     for (int i = 1; i < num_args; i++) {
         if (args[i][0] == '-') {
@@ -122,31 +303,84 @@ void seek_command_handler(char **args, int num_args, char *home_dir) {
                 show_files = 0;
             } else if (strcmp(args[i], "-e") == 0) {
                 exact_match = 1;
+            } else if (strcmp(args[i], "-g") == 0 && i + 1 < num_args) {
+                content = args[++i];
+            } else if ((strcmp(args[i], "-p") == 0 || strcmp(args[i], "--glob") == 0 || strcmp(args[i], "-r") == 0) &&
+                       i + 1 < num_args && patterns != NULL && kinds != NULL) {
+                kinds[num_patterns] = (args[i][1] == 'p') ? NAME_SUBSTRING : (args[i][1] == 'r') ? NAME_REGEX : NAME_GLOB;
+                patterns[num_patterns++] = args[++i];
+            } else if ((strcmp(args[i], "--max-depth") == 0 || strcmp(args[i], "--max-results") == 0) && i + 1 < num_args) {
+                char *end;
+                long value = strtol(args[i + 1], &end, 10);
+                if (*end != '\0' || value < 1) {
+                    fprintf(stderr, RED "%s needs a positive number\n" RESET, args[i]);
+                    free(patterns);
+                    free(kinds);
+                    return;
+                }
+                if (strcmp(args[i], "--max-depth") == 0) {
+                    walk.max_depth = (value > INT_MAX) ? INT_MAX : (int)value;
+                } else {
+                    max_results = value;
+                }
+                i++;
+            } else if (strcmp(args[i], "--gitignore") == 0) {
+                walk.ignore |= IGNORE_GIT;
             } else {
                 fprintf(stderr,RED "Invalid flag: %s\n" RESET, args[i]);
+                free(patterns);
+                free(kinds);
                 return;
             }
-        } else {
-            if (!search_term) {
-                search_term = args[i];
-            } else {
-                target_dir = args[i];
-            }
+        } else if (num_positional < 2) {
+            positional[num_positional++] = args[i];
         }
     }
 
-    if (!search_term) {
+    // With pattern flags or -g a lone argument is the directory; otherwise
+    // the first one is the search term and the second the directory
+    int have_flags = (num_patterns > 0 || content != NULL);
+    if (num_positional == 2 || (num_positional == 1 && !have_flags)) {
+        search_term = positional[0];
+    }
+    if (num_positional == 2 || (num_positional == 1 && have_flags)) {
+        target_dir = positional[num_positional - 1];
+    }
+
+    if (!search_term && !have_flags) {
         fprintf(stderr, "Usage: seek <flags> <search_term> <target_directory>\n");
+        free(patterns);
+        free(kinds);
         return;
     }
 
     if (!show_files && !show_dirs) {
         fprintf(stderr,RED "Invalid flags!\n" RESET);
+        free(patterns);
+        free(kinds);
+        return;
+    }
+
+    // Every pattern is compiled into one matcher, so one walk serves them all.
+    // -e makes the search term and -p patterns match whole names.
+    NameMatcher matcher = { 0 };
+    NamePatternKind plain = exact_match ? NAME_EXACT : NAME_SUBSTRING;
+    if (search_term) {
+        name_matcher_add(&matcher, plain, search_term);
+    }
+    for (int i = 0; i < num_patterns; i++) {
+        name_matcher_add(&matcher, kinds[i] == NAME_SUBSTRING ? plain : kinds[i], patterns[i]);
+    }
+    free(patterns);
+    free(kinds);
+    if (name_matcher_compile(&matcher, walk_workers()) != 0) {
+        name_matcher_clear(&matcher);
         return;
     }
 
     // Resolve the target directory path
     if (resolve_path(resolved_path, home_dir, target_dir) != 0) {
+        name_matcher_clear(&matcher);
         return;
     }
 
@@ -154,11 +388,21 @@ void seek_command_handler(char **args, int num_args, char *home_dir) {
     char result_path[MAX_PATH] = {0};
 
     // Start searching the directory
-    int match_count = search_directory(resolved_path, resolved_path, search_term, show_files, show_dirs, exact_match, result_path);
+    // -g searches inside the files, so only files are reported
+    SeekSearch search = { &matcher, search_term != NULL || num_patterns > 0, show_files, content == NULL && show_dirs, content };
+    search.walk = walk;
+    search.max_results = max_results;
+    if (exact_match && content == NULL && max_results == 1) {
+        // -e acts only on a single match, which one found match cannot show
+        search.max_results = 2;
+        search.max_printed = 1;
+    }
+    int match_count = search_directory(resolved_path, home_dir, &search, result_path);
+    name_matcher_clear(&matcher);
 
     if (match_count == 0) {
         printf(RED "No match found!\n" RESET);
-    } else if (exact_match && match_count == 1) {
+    } else if (exact_match && match_count == 1 && content == NULL) {
         struct stat statbuf;
         if (stat(result_path, &statbuf) == -1) {
             perror(RED "stat" RESET);
@@ -177,15 +421,15 @@ void seek_command_handler(char **args, int num_args, char *home_dir) {
             }
         } else if (S_ISREG(statbuf.st_mode)) {
             if (access(result_path, R_OK) == 0) {
-                FILE *file = fopen(result_path, "r");
-                if (file) {
-                    char ch;
-                    while ((ch = fgetc(file)) != EOF) {
-                        putchar(ch);
+                int fd = open(result_path, O_RDONLY | O_CLOEXEC);
+                if (fd >= 0) {
+                    fflush(stdout);  // The file goes straight to the descriptor
+                    if (copy_fd(fd, STDOUT_FILENO) != 0) {
+                        perror(RED "Error printing file" RESET);
                     }
-                    fclose(file);
+                    close(fd);
                 } else {
-                    perror(RED "fopen" RESET);
+                    perror(RED "open" RESET);
                 }
             } else {
                 printf(RED "Missing permissions for task!\n"RESET);
@@ -0,0 +1,589 @@
+#define _GNU_SOURCE
+#include "seekindex.h"
+#include "log.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// An index file holds a header, the directories, the entries and then all
+// the strings (the root, directory paths and entry names, NUL-terminated).
+// The entries of one directory are contiguous, so a directory that has not
+// changed since the index was written (same inode and mtime) can be trusted
+// as a whole; a directory's mtime changes whenever an entry is added,
+// removed or renamed in it.
+#define SEEK_INDEX_MAGIC 0x3158444e494b4553ULL  // "SEEKINDX1"
+#define NO_DIR UINT32_MAX
+
+typedef struct IndexHeader {
+    uint64_t magic;
+    uint32_t num_dirs;
+    uint32_t num_entries;
+    uint64_t strings_size;
+    uint32_t root;             // Offset of the root's absolute path
+    uint32_t unused;
+} IndexHeader;
+
+typedef struct IndexDir {
+    uint64_t inode;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path;             // Relative to the root ("" for the root itself)
+    uint32_t first_entry;
+    uint32_t num_entries;
+    uint32_t unused;
+} IndexDir;
+
+typedef struct IndexEntry {
+    uint32_t name;
+    uint32_t child;            // The IndexDir of a directory that was read, else NO_DIR
+    uint8_t type;              // WalkType
+    uint8_t is_link;
+    uint16_t unused;
+} IndexEntry;
+
+// A mapped index file
+typedef struct IndexMap {
+    void *map;
+    size_t size;
+    const IndexHeader *header;
+    const IndexDir *dirs;
+    const IndexEntry *entries;
+    const char *strings;
+} IndexMap;
+
+// An index being built in memory
+typedef struct IndexBuilder {
+    IndexDir *dirs;
+    size_t num_dirs, dirs_capacity;
+    IndexEntry *entries;
+    size_t num_entries, entries_capacity;
+    char *strings;
+    size_t strings_size, strings_capacity;
+    const IndexMap *old;       // The previous index, whose unchanged directories are copied
+    size_t reread;             // Directories that had to be read
+    int failed;
+} IndexBuilder;
+
+static int grow(void **array, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = (*capacity == 0) ? 1024 : *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *grown = realloc(*array, new_capacity * item_size);
+    if (grown == NULL) {
+        perror(RED "realloc failed" RESET);
+        return -1;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static uint32_t add_string(IndexBuilder *builder, const char *text, size_t length) {
+    if (builder->strings_size + length + 1 > UINT32_MAX ||
+        grow((void **)&builder->strings, &builder->strings_capacity, builder->strings_size + length + 1, 1) != 0) {
+        builder->failed = 1;
+        return 0;
+    }
+    uint32_t offset = builder->strings_size;
+    memcpy(builder->strings + offset, text, length);
+    builder->strings[offset + length] = '\0';
+    builder->strings_size += length + 1;
+    return offset;
+}
+
+static IndexEntry *add_entry(IndexBuilder *builder, const char *name, WalkType type, int is_link) {
+    if (grow((void **)&builder->entries, &builder->entries_capacity, builder->num_entries + 1, sizeof(IndexEntry)) != 0) {
+        builder->failed = 1;
+        return NULL;
+    }
+    IndexEntry *entry = &builder->entries[builder->num_entries++];
+    *entry = (IndexEntry){ add_string(builder, name, strlen(name)), NO_DIR, type, is_link };
+    return entry;
+}
+
+// Index file of a root: a hash of its path, so that finding the index of a
+// directory only takes trying each of its ancestors
+static void index_path(char *path, size_t size, const char *home_dir, const char *root, size_t root_length) {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (size_t i = 0; i < root_length; i++) {
+        hash = (hash ^ (unsigned char)root[i]) * 1099511628211ULL;
+    }
+    snprintf(path, size, "%s/%s/%016llx.idx", home_dir, SEEK_INDEX_DIR, (unsigned long long)hash);
+}
+
+static void unmap_index(IndexMap *index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+// Whether every offset and count in a mapped index stays inside it, so that
+// a corrupt file is rejected rather than read out of bounds. A directory's
+// children always come after it, which also rules out cycles.
+static int offsets_valid(const IndexMap *index) {
+    const IndexHeader *header = index->header;
+    for (uint32_t i = 0; i < header->num_dirs; i++) {
+        const IndexDir *dir = &index->dirs[i];
+        if (dir->path >= header->strings_size ||
+            (uint64_t)dir->first_entry + dir->num_entries > header->num_entries) {
+            return 0;
+        }
+        for (uint32_t j = 0; j < dir->num_entries; j++) {
+            const IndexEntry *entry = &index->entries[dir->first_entry + j];
+            if (entry->name >= header->strings_size || entry->type > WALK_OTHER ||
+                (entry->child != NO_DIR && (entry->child <= i || entry->child >= header->num_dirs))) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Maps the index of exactly this root. Returns 0 on success.
+static int map_index_file(IndexMap *index, const char *home_dir, const char *root, size_t root_length) {
+    char path[PATH_MAX + 64];
+    index_path(path, sizeof(path), home_dir, root, root_length);
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    index->map = map;
+    index->size = st.st_size;
+    index->header = map;
+
+    // Check that it is whole and that it is the index of this root
+    const IndexHeader *header = index->header;
+    size_t expected = sizeof(IndexHeader) + (size_t)header->num_dirs * sizeof(IndexDir) +
+                      (size_t)header->num_entries * sizeof(IndexEntry) + header->strings_size;
+    if (header->magic != SEEK_INDEX_MAGIC || expected != index->size || header->num_dirs == 0) {
+        unmap_index(index);
+        return -1;
+    }
+    index->dirs = (const IndexDir *)(header + 1);
+    index->entries = (const IndexEntry *)(index->dirs + header->num_dirs);
+    index->strings = (const char *)(index->entries + header->num_entries);
+    if (header->root >= header->strings_size || index->strings[header->strings_size - 1] != '\0' ||
+        strlen(index->strings + header->root) != root_length ||
+        memcmp(index->strings + header->root, root, root_length) != 0 || !offsets_valid(index)) {
+        unmap_index(index);
+        return -1;
+    }
+    return 0;
+}
+
+static int same_version(const IndexDir *dir, const struct stat *st) {
+    return dir->inode == (uint64_t)st->st_ino && dir->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+           dir->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+static const IndexMap *sort_old;  // For compare_old_names
+
+static int compare_old_names(const void *a, const void *b) {
+    const IndexEntry *x = *(const IndexEntry *const *)a, *y = *(const IndexEntry *const *)b;
+    return strcmp(sort_old->strings + x->name, sort_old->strings + y->name);
+}
+
+// The old directory of a subdirectory called name, given the old entries of
+// its parent sorted by name
+static uint32_t find_old_child(const IndexMap *old, const IndexEntry **sorted, size_t count, const char *name) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        int order = strcmp(old->strings + sorted[mid]->name, name);
+        if (order == 0) return sorted[mid]->child;
+        if (order < 0) low = mid + 1; else high = mid;
+    }
+    return NO_DIR;
+}
+
+// Whether name is one of the directories the shell itself keeps writing to.
+// Indexing their contents would make the index stale as soon as it is saved
+// (into SEEK_INDEX_DIR) or a command is logged.
+static int shell_directory(const char *name) {
+    return strcmp(name, SEEK_INDEX_DIR) == 0 || strcmp(name, LOG_DIRECTORY) == 0;
+}
+
+// Whether a path relative to an indexed root passes through a directory
+// the index leaves out, so that no rebuild would ever find it
+static int passes_shell_directory(const char *relative) {
+    while (*relative != '\0') {
+        size_t length = strcspn(relative, "/");
+        char name[NAME_MAX + 1];
+        snprintf(name, sizeof(name), "%.*s", (int)length, relative);
+        if (shell_directory(name)) {
+            return 1;
+        }
+        relative += length;
+        while (*relative == '/') relative++;
+    }
+    return 0;
+}
+
+// Creates SEEK_INDEX_DIR before a build, so that creating it later does not
+// change the home directory the index has just recorded
+static int make_index_dir(const char *home_dir) {
+    char dir[PATH_MAX + 64];
+    snprintf(dir, sizeof(dir), "%s/%s", home_dir, SEEK_INDEX_DIR);
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        perror(RED "Error creating index directory" RESET);
+        return -1;
+    }
+    return 0;
+}
+
+// Adds the directory fd (at path, relative to the root) and everything below
+// it. old_dir is its directory in the previous index, or NO_DIR.
+static uint32_t build_dir(IndexBuilder *builder, int fd, const char *path, uint32_t old_dir) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        grow((void **)&builder->dirs, &builder->dirs_capacity, builder->num_dirs + 1, sizeof(IndexDir)) != 0) {
+        close(fd);
+        builder->failed = 1;
+        return NO_DIR;
+    }
+    uint32_t id = builder->num_dirs++;
+    uint32_t first = builder->num_entries;
+    builder->dirs[id] = (IndexDir){ st.st_ino, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+                                    add_string(builder, path, strlen(path)), first, 0 };
+
+    const IndexMap *old = builder->old;
+    const IndexDir *previous = (old_dir != NO_DIR) ? &old->dirs[old_dir] : NULL;
+    const IndexEntry **sorted = NULL;
+    if (previous != NULL && same_version(previous, &st)) {
+        // Unchanged: its entries are copied rather than read
+        for (uint32_t i = 0; i < previous->num_entries; i++) {
+            const IndexEntry *entry = &old->entries[previous->first_entry + i];
+            if (add_entry(builder, old->strings + entry->name, entry->type, entry->is_link) == NULL) break;
+        }
+    } else {
+        builder->reread++;
+        DIR *dir = fdopendir(dup(fd));
+        if (dir == NULL) {
+            perror(RED "opendir" RESET);
+        } else {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                const char *name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                    continue;
+                }
+                WalkType type = (entry->d_type == DT_DIR) ? WALK_DIR : (entry->d_type == DT_REG) ? WALK_FILE : WALK_OTHER;
+                int is_link = 0;
+                if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+                    struct stat entry_st;
+                    if (fstatat(fd, name, &entry_st, AT_SYMLINK_NOFOLLOW) == 0) {
+                        is_link = S_ISLNK(entry_st.st_mode);
+                        if (!is_link || fstatat(fd, name, &entry_st, 0) == 0) {
+                            type = S_ISDIR(entry_st.st_mode) ? WALK_DIR : S_ISREG(entry_st.st_mode) ? WALK_FILE : WALK_OTHER;
+                        }
+                    }
+                }
+                if (add_entry(builder, name, type, is_link) == NULL) break;
+            }
+            closedir(dir);
+        }
+
+        // Subdirectories that were there before can still reuse what is below them
+        if (previous != NULL && previous->num_entries > 0) {
+            sorted = malloc(previous->num_entries * sizeof(*sorted));
+            if (sorted != NULL) {
+                for (uint32_t i = 0; i < previous->num_entries; i++) {
+                    sorted[i] = &old->entries[previous->first_entry + i];
+                }
+                sort_old = old;
+                qsort(sorted, previous->num_entries, sizeof(*sorted), compare_old_names);
+            }
+        }
+    }
+    uint32_t last = builder->num_entries;
+    builder->dirs[id].num_entries = last - first;
+
+    // The entries come first so that they stay contiguous
+    for (uint32_t i = first; i < last && !builder->failed; i++) {
+        IndexEntry *entry = &builder->entries[i];
+        if (entry->type != WALK_DIR || entry->is_link) {
+            continue;
+        }
+        const char *name = builder->strings + entry->name;
+        if (shell_directory(name)) {
+            continue;  // Listed, but what the shell writes there is left out
+        }
+        uint32_t old_child = NO_DIR;
+        if (previous != NULL && sorted == NULL && same_version(previous, &st)) {
+            old_child = old->entries[previous->first_entry + (i - first)].child;
+        } else if (sorted != NULL) {
+            old_child = find_old_child(old, sorted, previous->num_entries, name);
+        }
+        int child_fd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_fd < 0) {
+            continue;  // Listed, but not searched below
+        }
+        size_t path_length = strlen(path), name_length = strlen(name);
+        char *child_path = malloc(path_length + name_length + 2);
+        if (child_path == NULL) {
+            close(child_fd);
+            builder->failed = 1;
+            break;
+        }
+        memcpy(child_path, path, path_length);
+        if (path_length > 0) child_path[path_length++] = '/';
+        memcpy(child_path + path_length, name, name_length + 1);
+        uint32_t child = build_dir(builder, child_fd, child_path, old_child);
+        builder->entries[i].child = child;  // The array may have moved
+        free(child_path);
+    }
+    free(sorted);
+    close(fd);
+    return id;
+}
+
+// Writes the built index under a temporary name and renames it into place
+static int write_index(IndexBuilder *builder, const char *home_dir, const char *root) {
+    char path[PATH_MAX + 64], temp[PATH_MAX + 96];
+    if (make_index_dir(home_dir) != 0) {
+        return -1;
+    }
+    index_path(path, sizeof(path), home_dir, root, strlen(root));
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+
+    IndexHeader header = { SEEK_INDEX_MAGIC, builder->num_dirs, builder->num_entries, 0, 0, 0 };
+    header.root = add_string(builder, root, strlen(root));
+    header.strings_size = builder->strings_size;
+    if (builder->failed) {
+        return -1;
+    }
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror(RED "Error writing index" RESET);
+        return -1;
+    }
+    FILE *file = fdopen(fd, "w");
+    int ok = file != NULL &&
+             fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(builder->dirs, sizeof(IndexDir), builder->num_dirs, file) == builder->num_dirs &&
+             fwrite(builder->entries, sizeof(IndexEntry), builder->num_entries, file) == builder->num_entries &&
+             fwrite(builder->strings, 1, builder->strings_size, file) == builder->strings_size;
+    if (file != NULL) {
+        ok = (fclose(file) == 0) && ok;
+    } else {
+        close(fd);
+    }
+    if (!ok || rename(temp, path) != 0) {
+        perror(RED "Error writing index" RESET);
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_builder(IndexBuilder *builder) {
+    free(builder->dirs);
+    free(builder->entries);
+    free(builder->strings);
+}
+
+// Builds the index of root into builder, reusing old if it is not NULL
+static int build_index(IndexBuilder *builder, const char *root, const char *home_dir, const IndexMap *old) {
+    memset(builder, 0, sizeof(*builder));
+    builder->old = (old != NULL && old->map != NULL) ? old : NULL;
+    if (make_index_dir(home_dir) != 0) {
+        return -1;
+    }
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(RED "opendir" RESET);
+        return -1;
+    }
+    build_dir(builder, fd, "", builder->old != NULL ? 0 : NO_DIR);
+    return builder->failed ? -1 : 0;
+}
+
+int seek_index_build(const char *root, const char *home_dir) {
+    IndexMap old;
+    int have_old = (map_index_file(&old, home_dir, root, strlen(root)) == 0);
+    IndexBuilder builder;
+    int result = build_index(&builder, root, home_dir, have_old ? &old : NULL);
+    if (result == 0) {
+        result = write_index(&builder, home_dir, root);
+    }
+    if (result == 0) {
+        printf("Indexed %zu entries in %zu directories (%zu read)\n",
+               builder.num_entries, builder.num_dirs, builder.reread);
+    }
+    free_builder(&builder);
+    if (have_old) unmap_index(&old);
+    return result;
+}
+
+// Finds the directory of the index with the given path, or NO_DIR
+static uint32_t find_dir(const IndexMap *index, const char *path) {
+    for (uint32_t i = 0; i < index->header->num_dirs; i++) {
+        if (strcmp(index->strings + index->dirs[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return NO_DIR;
+}
+
+// Whether every directory below (and including) dir is as the index says
+static int subtree_current(const IndexMap *index, int root_fd, uint32_t dir) {
+    const IndexDir *d = &index->dirs[dir];
+    struct stat st;
+    const char *path = index->strings + d->path;
+    if (fstatat(root_fd, path[0] ? path : ".", &st, AT_SYMLINK_NOFOLLOW) != 0 || !same_version(d, &st)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < d->num_entries; i++) {
+        uint32_t child = index->entries[d->first_entry + i].child;
+        if (child != NO_DIR && !subtree_current(index, root_fd, child)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// What one search hands down to every directory it visits
+typedef struct IndexVisit {
+    const IndexMap *index;
+    int root_fd;
+    size_t prefix_length;      // Left out of the paths: the searched directory and its slash
+    WalkOptions options;
+    walk_callback visit;
+    void *arg;
+} IndexVisit;
+
+// Whether the index lists one of the ignore files the search reads in dir
+static int has_ignore_file(const IndexMap *index, const IndexDir *dir, int ignore) {
+    for (uint32_t i = 0; i < dir->num_entries; i++) {
+        const char *name = index->strings + index->entries[dir->first_entry + i].name;
+        if (((ignore & IGNORE_SEEK) && strcmp(name, ".seekignore") == 0) ||
+            ((ignore & IGNORE_GIT) && strcmp(name, ".gitignore") == 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Reports everything below dir, whose entries are at the given depth, as
+// walk_tree would. Returns 1 once the callback asked to stop.
+static int visit_subtree(const IndexVisit *search, uint32_t dir, int depth, IgnoreRules *parent) {
+    const IndexMap *index = search->index;
+    const IndexDir *d = &index->dirs[dir];
+    const char *path = index->strings + d->path;
+    const char *relative = path + (strlen(path) > search->prefix_length ? search->prefix_length : strlen(path));
+
+    // Only the ignore files themselves are read; the rest comes from the index
+    int ignore = search->options.ignore;
+    IgnoreRules *rules = ignore_retain(parent);
+    if (ignore && has_ignore_file(index, d, ignore)) {
+        int fd = openat(search->root_fd, path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            ignore_release(rules);
+            rules = ignore_enter(parent, fd, relative, ignore);
+            close(fd);
+        }
+    }
+
+    int max_depth = search->options.max_depth;
+    int stopped = 0;
+    WalkEntry found = { -1, relative };
+    found.depth = depth;
+    for (uint32_t i = 0; i < d->num_entries && !stopped; i++) {
+        const IndexEntry *entry = &index->entries[d->first_entry + i];
+        found.name = index->strings + entry->name;
+        found.type = entry->type;
+        found.is_link = entry->is_link;
+        if (ignore && ignore_check(rules, relative, found.name, found.type == WALK_DIR && !found.is_link, ignore)) {
+            continue;
+        }
+        WalkAction action = search->visit(&found, 0, search->arg);
+        if (action == WALK_STOP) {
+            stopped = 1;
+        } else if (entry->child != NO_DIR && action != WALK_PRUNE && (max_depth == 0 || depth < max_depth)) {
+            stopped = visit_subtree(search, entry->child, depth + 1, rules);
+        }
+    }
+    ignore_release(rules);
+    return stopped;
+}
+
+int seek_index_search(const char *dir, const char *home_dir, const WalkOptions *options, walk_callback visit, void *arg) {
+    // The nearest indexed ancestor (or dir itself)
+    IndexMap index;
+    size_t root_length = strlen(dir);
+    while (map_index_file(&index, home_dir, dir, root_length) != 0) {
+        while (root_length > 0 && dir[root_length - 1] != '/') root_length--;
+        if (root_length <= 1) {
+            if (root_length == 1 && map_index_file(&index, home_dir, "/", 1) == 0) break;
+            return 0;
+        }
+        root_length--;  // Drop the slash
+    }
+
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%.*s", (int)root_length, dir);
+    const char *relative = dir + root_length;
+    while (*relative == '/') relative++;
+    if (passes_shell_directory(relative)) {
+        unmap_index(&index);
+        return 0;  // Walk the tree instead
+    }
+
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    uint32_t start = find_dir(&index, relative);
+    if (root_fd < 0 || start == NO_DIR || !subtree_current(&index, root_fd, start)) {
+        // Read the directories that changed and save the result for next time
+        IndexBuilder builder;
+        if (root_fd < 0 || build_index(&builder, root, home_dir, &index) != 0 || write_index(&builder, home_dir, root) != 0) {
+            if (root_fd >= 0) {
+                free_builder(&builder);
+                close(root_fd);
+            }
+            unmap_index(&index);
+            return 0;  // Walk the tree instead
+        }
+        free_builder(&builder);
+        unmap_index(&index);
+        if (map_index_file(&index, home_dir, root, root_length) != 0) {
+            close(root_fd);
+            return 0;
+        }
+        start = find_dir(&index, relative);
+        if (start == NO_DIR) {
+            // Left out of the index, e.g. unreadable when it was built
+            close(root_fd);
+            unmap_index(&index);
+            return 0;
+        }
+    }
+
+    IndexVisit search = { &index, root_fd, relative[0] ? strlen(relative) + 1 : 0, { 0 }, visit, arg };
+    if (options != NULL) {
+        search.options = *options;
+    }
+    visit_subtree(&search, start, 1, NULL);
+    close(root_fd);
+    unmap_index(&index);
+    return 1;
+}
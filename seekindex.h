@@ -0,0 +1,21 @@
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+#include "walk.h"
+
+#define SEEK_INDEX_DIR ".seek_index"  // Under the shell's home directory
+
+// Indexes the names of everything below root (an absolute path), reusing the
+// parts of an existing index whose directories have not changed. Prints a
+// summary. Returns 0 on success.
+int seek_index_build(const char *root, const char *home_dir);
+
+// If dir (an absolute path) is inside an indexed tree, calls visit for every
+// entry below it, as walk_tree would but from a single thread, with dir_fd
+// set to -1 and paths relative to dir. options apply as they do there; only
+// the ignore files are read from disk. Directories that changed since the
+// index was written are read again first and the index is updated.
+// Returns 1 if the index answered, or 0 if there is none for dir.
+int seek_index_search(const char *dir, const char *home_dir, const WalkOptions *options, walk_callback visit, void *arg);
+
+#endif // SEEKINDEX_H
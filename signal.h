@@ -8,6 +8,9 @@ extern pid_t foreground_pid;
 // Function to send a signal to a process
 void send_signal(pid_t pid, int signal_number);
 
+// Handlers for Ctrl-C, Ctrl-\ and Ctrl-Z, called from the event loop
+// (see events.c) rather than from signal context
+
 // Function to handle Ctrl-C (SIGINT)
 void handle_sigint(int signum);
 
@@ -17,7 +20,4 @@ void handle_sigquit(int signum);
 // Function to handle Ctrl-Z (SIGTSTP)
 void handle_sigtstp(int signum);
 
-// Function to set up signal handlers
-void setup_signal_handlers();
-
 #endif
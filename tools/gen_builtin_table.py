@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Generates builtin_table.h: a perfect hash table of the shell's builtins.
+
+Run from the repository root after adding a builtin to BUILTINS:
+    python3 tools/gen_builtin_table.py > builtin_table.h
+"""
+
+# Builtin name -> handler function defined in builtin.c
+BUILTINS = [
+    ("activities", "builtin_activities"),
+    ("bg", "builtin_bg"),
+    ("cat", "builtin_cat"),
+    ("exit", "builtin_exit"),
+    ("fg", "builtin_fg"),
+    ("hash", "builtin_hash"),
+    ("hop", "builtin_hop"),
+    ("iMan", "builtin_iman"),
+    ("log", "builtin_log"),
+    ("neonate", "builtin_neonate"),
+    ("parallel", "builtin_parallel"),
+    ("ping", "builtin_ping"),
+    ("proclore", "builtin_proclore"),
+    ("reveal", "builtin_reveal"),
+    ("seek", "builtin_seek"),
+]
+
+
+def fnv1a(name, seed):
+    h = seed
+    for byte in name.encode():
+        h ^= byte
+        h = (h * 16777619) & 0xFFFFFFFF
+    # Fold the well-mixed high bits into the low bits used for the slot
+    return h ^ (h >> 16)
+
+
+def find_seed(names, size):
+    for seed in range(1, 1 << 20):
+        slots = {fnv1a(name, seed) & (size - 1) for name in names}
+        if len(slots) == len(names):
+            return seed
+    return None
+
+
+def main():
+    names = [name for name, _ in BUILTINS]
+    size = 1
+    while size < 2 * len(names):
+        size *= 2
+    seed = find_seed(names, size)
+    while seed is None:
+        size *= 2
+        seed = find_seed(names, size)
+
+    table = [None] * size
+    for name, handler in BUILTINS:
+        table[fnv1a(name, seed) & (size - 1)] = (name, handler)
+
+    print("// Generated by tools/gen_builtin_table.py. Do not edit by hand.")
+    print("#ifndef BUILTIN_TABLE_H")
+    print("#define BUILTIN_TABLE_H")
+    print()
+    print("#define BUILTIN_HASH_SEED %uu" % seed)
+    print("#define BUILTIN_TABLE_SIZE %d" % size)
+    print()
+    print("static const Builtin builtin_table[BUILTIN_TABLE_SIZE] = {")
+    for slot, entry in enumerate(table):
+        if entry is not None:
+            print('    [%d] = { "%s", %s },' % (slot, entry[0], entry[1]))
+    print("};")
+    print()
+    print("#endif // BUILTIN_TABLE_H")
+
+
+if __name__ == "__main__":
+    main()
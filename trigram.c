@@ -0,0 +1,148 @@
+#include "trigram.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t trigram_at(const char *text) {
+    const unsigned char *p = (const unsigned char *)text;
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static size_t trigram_slot(const TrigramPostings *slots, size_t size, uint32_t trigram) {
+    size_t slot = (trigram * 2654435761u) & (size - 1);
+    while (slots[slot].capacity != 0 && slots[slot].trigram != trigram) {
+        slot = (slot + 1) & (size - 1);
+    }
+    return slot;
+}
+
+static const TrigramPostings *find_postings(const TrigramIndex *index, uint32_t trigram) {
+    if (index->size == 0) {
+        return NULL;
+    }
+    const TrigramPostings *postings = &index->slots[trigram_slot(index->slots, index->size, trigram)];
+    return postings->capacity != 0 ? postings : NULL;
+}
+
+static int grow_table(TrigramIndex *index) {
+    size_t new_size = (index->size == 0) ? 1024 : index->size * 2;
+    TrigramPostings *slots = calloc(new_size, sizeof(TrigramPostings));
+    if (slots == NULL) {
+        perror(RED "malloc failed" RESET);
+        return -1;
+    }
+    for (size_t i = 0; i < index->size; i++) {
+        if (index->slots[i].capacity != 0) {
+            slots[trigram_slot(slots, new_size, index->slots[i].trigram)] = index->slots[i];
+        }
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->size = new_size;
+    return 0;
+}
+
+static void add_posting(TrigramIndex *index, uint32_t trigram, uint32_t id) {
+    if ((index->used + 1) * 2 > index->size && grow_table(index) != 0) {
+        return;
+    }
+    TrigramPostings *postings = &index->slots[trigram_slot(index->slots, index->size, trigram)];
+    if (postings->capacity == 0) {
+        postings->ids = malloc(4 * sizeof(uint32_t));
+        if (postings->ids == NULL) {
+            perror(RED "malloc failed" RESET);
+            return;
+        }
+        postings->trigram = trigram;
+        postings->count = 0;
+        postings->capacity = 4;
+        index->used++;
+    } else if (postings->ids[postings->count - 1] == id) {
+        return;  // Already seen earlier in this entry
+    } else if (postings->count == postings->capacity) {
+        uint32_t *ids = realloc(postings->ids, 2 * postings->capacity * sizeof(uint32_t));
+        if (ids == NULL) {
+            perror(RED "realloc failed" RESET);
+            return;
+        }
+        postings->ids = ids;
+        postings->capacity *= 2;
+    }
+    postings->ids[postings->count++] = id;
+}
+
+void trigram_index_add(TrigramIndex *index, uint32_t id, const char *text, size_t length) {
+    for (size_t i = 0; i + 3 <= length; i++) {
+        add_posting(index, trigram_at(text + i), id);
+    }
+}
+
+static int contains_id(const TrigramPostings *postings, uint32_t id) {
+    size_t low = 0, high = postings->count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (postings->ids[mid] < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < postings->count && postings->ids[low] == id;
+}
+
+uint32_t *trigram_index_query(const TrigramIndex *index, const char *pattern, size_t length, size_t *count) {
+    *count = 0;
+    if (length < 3) {
+        *count = SIZE_MAX;
+        return NULL;
+    }
+
+    // Start from the rarest trigram and keep the ids every other list has too
+    size_t num_lists = length - 2;
+    const TrigramPostings **lists = malloc(num_lists * sizeof(*lists));
+    if (lists == NULL) {
+        perror(RED "malloc failed" RESET);
+        return NULL;
+    }
+    size_t rarest = 0;
+    for (size_t i = 0; i < num_lists; i++) {
+        lists[i] = find_postings(index, trigram_at(pattern + i));
+        if (lists[i] == NULL) {
+            free(lists);
+            return NULL;  // Some trigram occurs nowhere
+        }
+        if (lists[i]->count < lists[rarest]->count) {
+            rarest = i;
+        }
+    }
+
+    uint32_t *ids = malloc(lists[rarest]->count * sizeof(uint32_t));
+    if (ids == NULL) {
+        perror(RED "malloc failed" RESET);
+        free(lists);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < lists[rarest]->count; i++) {
+        uint32_t id = lists[rarest]->ids[i];
+        size_t j = 0;
+        while (j < num_lists && (lists[j] == lists[rarest] || contains_id(lists[j], id))) {
+            j++;
+        }
+        if (j == num_lists) {
+            ids[(*count)++] = id;
+        }
+    }
+    free(lists);
+    return ids;
+}
+
+void trigram_index_clear(TrigramIndex *index) {
+    for (size_t i = 0; i < index->size; i++) {
+        free(index->slots[i].ids);
+    }
+    free(index->slots);
+    index->slots = NULL;
+    index->size = 0;
+    index->used = 0;
+}
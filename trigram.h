@@ -0,0 +1,33 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// For each sequence of three bytes, the ids of the entries that contain it
+typedef struct TrigramPostings {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t capacity;    // 0 marks an empty slot
+    uint32_t *ids;        // Ascending
+} TrigramPostings;
+
+// Open-addressing table of posting lists, kept at most half full
+typedef struct TrigramIndex {
+    TrigramPostings *slots;
+    size_t size;
+    size_t used;
+} TrigramIndex;
+
+// Adds entry id with the given text. Ids must be added in ascending order.
+void trigram_index_add(TrigramIndex *index, uint32_t id, const char *text, size_t length);
+
+// Returns the ids (ascending) of the entries containing every trigram of
+// pattern, which includes every entry containing pattern, as a malloc'd array
+// of *count ids. A pattern shorter than three bytes has no trigrams: then
+// NULL is returned with *count set to SIZE_MAX, meaning every entry.
+uint32_t *trigram_index_query(const TrigramIndex *index, const char *pattern, size_t length, size_t *count);
+
+void trigram_index_clear(TrigramIndex *index);
+
+#endif // TRIGRAM_H
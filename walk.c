@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include "walk.h"
+#include "color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+// A directory waiting to be read
+typedef struct WalkTask {
+    int fd;                    // Opened by whoever found it, or -1 to open it by path
+    char *path;                // Relative to the root (malloc'd)
+    int depth;                 // Of its entries
+    IgnoreRules *rules;        // What applies to it from the directories above (one reference)
+} WalkTask;
+
+// The queue of one worker. The owner pushes and pops at the end; other
+// workers steal from the start, which holds the oldest and, being closest
+// to the root, usually the largest pieces of work.
+typedef struct WalkDeque {
+    pthread_mutex_t lock;
+    WalkTask *tasks;
+    size_t head;               // Oldest task not taken yet
+    size_t tail;
+    size_t capacity;
+} WalkDeque;
+
+typedef struct Walker {
+    int root_fd;
+    int num_workers;
+    WalkDeque deques[WALK_MAX_WORKERS];
+    walk_callback visit;
+    void *arg;
+    WalkOptions options;
+    atomic_int stopped;        // Set once a callback returned WALK_STOP
+    atomic_size_t queued;      // Tasks sitting in some deque
+    atomic_size_t outstanding; // Tasks queued or being read; the walk ends at 0
+    atomic_int open_fds;       // Descriptors held by queued tasks
+    int fd_budget;             // Most of those at once
+    atomic_int idle;           // Workers waiting for work
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_ready;
+} Walker;
+
+typedef struct WalkWorker {
+    Walker *walker;
+    int index;
+} WalkWorker;
+
+int walk_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    return (cpus > WALK_MAX_WORKERS) ? WALK_MAX_WORKERS : (int)cpus;
+}
+
+static void push_task(Walker *walker, int worker, WalkTask task) {
+    WalkDeque *deque = &walker->deques[worker];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head == deque->tail) {
+        deque->head = deque->tail = 0;
+    }
+    if (deque->tail == deque->capacity) {
+        size_t capacity = (deque->capacity == 0) ? 64 : deque->capacity * 2;
+        WalkTask *tasks = realloc(deque->tasks, capacity * sizeof(WalkTask));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            perror(RED "realloc failed" RESET);
+            if (task.fd >= 0) {
+                close(task.fd);
+                atomic_fetch_sub(&walker->open_fds, 1);
+            }
+            free(task.path);
+            ignore_release(task.rules);
+            return;
+        }
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->tail++] = task;
+    atomic_fetch_add(&walker->outstanding, 1);
+    atomic_fetch_add(&walker->queued, 1);
+    pthread_mutex_unlock(&deque->lock);
+
+    if (atomic_load(&walker->idle) > 0) {
+        pthread_mutex_lock(&walker->idle_lock);
+        pthread_cond_signal(&walker->work_ready);
+        pthread_mutex_unlock(&walker->idle_lock);
+    }
+}
+
+// Takes a task from the end of this worker's own deque, or from the start of
+// another one's. Returns 0 if every deque was empty.
+static int take_task(Walker *walker, int worker, WalkTask *task) {
+    for (int i = 0; i < walker->num_workers; i++) {
+        int victim = (worker + i) % walker->num_workers;
+        WalkDeque *deque = &walker->deques[victim];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) {
+            *task = (victim == worker) ? deque->tasks[--deque->tail] : deque->tasks[deque->head++];
+            atomic_fetch_sub(&walker->queued, 1);
+            pthread_mutex_unlock(&deque->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+    return 0;
+}
+
+static void finish_task(Walker *walker) {
+    if (atomic_fetch_sub(&walker->outstanding, 1) == 1) {
+        pthread_mutex_lock(&walker->idle_lock);
+        pthread_cond_broadcast(&walker->work_ready);  // Everyone is done
+        pthread_mutex_unlock(&walker->idle_lock);
+    }
+}
+
+// Tells what an entry is, stat'ing it only if readdir did not say
+static WalkType entry_type(int dir_fd, const struct dirent *entry, int *is_link) {
+    *is_link = 0;
+    switch (entry->d_type) {
+    case DT_DIR:
+        return WALK_DIR;
+    case DT_REG:
+        return WALK_FILE;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        break;
+    default:
+        return WALK_OTHER;
+    }
+
+    struct stat st;
+    if (fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return WALK_OTHER;
+    }
+    if (S_ISLNK(st.st_mode)) {
+        // Classified by what it points to, like stat() would
+        *is_link = 1;
+        if (fstatat(dir_fd, entry->d_name, &st, 0) != 0) {
+            return WALK_OTHER;  // Dangling
+        }
+    }
+    return S_ISDIR(st.st_mode) ? WALK_DIR : S_ISREG(st.st_mode) ? WALK_FILE : WALK_OTHER;
+}
+
+static char *child_path(const char *dir, const char *name) {
+    size_t dir_length = strlen(dir), name_length = strlen(name);
+    char *path = malloc(dir_length + name_length + 2);
+    if (path == NULL) {
+        perror(RED "malloc failed" RESET);
+        return NULL;
+    }
+    if (dir_length > 0) {
+        memcpy(path, dir, dir_length);
+        path[dir_length++] = '/';
+    }
+    memcpy(path + dir_length, name, name_length + 1);
+    return path;
+}
+
+// Reports every entry of the task's directory and queues its subdirectories
+static void read_directory(Walker *walker, int worker, WalkTask *task) {
+    int fd = task->fd;
+    if (fd >= 0) {
+        atomic_fetch_sub(&walker->open_fds, 1);
+    }
+    if (atomic_load(&walker->stopped)) {
+        if (fd >= 0) close(fd);  // Only emptying the queues now
+        return;
+    }
+    if (fd < 0) {
+        fd = openat(walker->root_fd, task->path[0] ? task->path : ".",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    }
+    DIR *dir = (fd >= 0) ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        perror(RED "opendir" RESET);
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    int ignore = walker->options.ignore;
+    IgnoreRules *rules = ignore ? ignore_enter(task->rules, fd, task->path, ignore) : NULL;
+    int max_depth = walker->options.max_depth;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && !atomic_load(&walker->stopped)) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        WalkEntry found = { fd, task->path, name };
+        found.type = entry_type(fd, entry, &found.is_link);
+        found.depth = task->depth;
+        int is_dir = (found.type == WALK_DIR && !found.is_link);
+        if (ignore && ignore_check(rules, task->path, name, is_dir, ignore)) {
+            continue;
+        }
+        WalkAction action = walker->visit(&found, worker, walker->arg);
+        if (action == WALK_STOP) {
+            atomic_store(&walker->stopped, 1);
+            break;
+        }
+
+        if (!is_dir || action == WALK_PRUNE || (max_depth > 0 && task->depth >= max_depth)) {
+            continue;
+        }
+        WalkTask child = { -1, child_path(task->path, name), task->depth + 1 };
+        if (child.path == NULL) {
+            continue;
+        }
+        child.rules = ignore_retain(rules);
+        // Opening it now saves resolving its path later, as long as that
+        // does not hold too many descriptors
+        if (atomic_fetch_add(&walker->open_fds, 1) < walker->fd_budget) {
+            child.fd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        }
+        if (child.fd < 0) {
+            atomic_fetch_sub(&walker->open_fds, 1);
+        }
+        push_task(walker, worker, child);
+    }
+    ignore_release(rules);
+    closedir(dir);
+}
+
+static void *worker_main(void *arg) {
+    WalkWorker *self = arg;
+    Walker *walker = self->walker;
+    while (1) {
+        WalkTask task;
+        if (take_task(walker, self->index, &task)) {
+            read_directory(walker, self->index, &task);
+            free(task.path);
+            ignore_release(task.rules);
+            finish_task(walker);
+            continue;
+        }
+
+        // Nothing to take: wait until something is queued or the walk is over
+        pthread_mutex_lock(&walker->idle_lock);
+        atomic_fetch_add(&walker->idle, 1);
+        while (atomic_load(&walker->queued) == 0 && atomic_load(&walker->outstanding) > 0) {
+            pthread_cond_wait(&walker->work_ready, &walker->idle_lock);
+        }
+        atomic_fetch_sub(&walker->idle, 1);
+        int done = (atomic_load(&walker->outstanding) == 0);
+        pthread_mutex_unlock(&walker->idle_lock);
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+int walk_tree(const char *root, const WalkOptions *options, walk_callback visit, void *arg) {
+    Walker walker = { 0 };
+    walker.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (walker.root_fd < 0) {
+        perror(RED "opendir" RESET);
+        return -1;
+    }
+    walker.num_workers = walk_workers();
+
+    // Queued directories may hold a quarter of what the process can open;
+    // the rest stays free for reading them and for the shell itself
+    struct rlimit limit;
+    walker.fd_budget = WALK_OPEN_FDS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        limit.rlim_cur / 4 < WALK_OPEN_FDS) {
+        walker.fd_budget = limit.rlim_cur / 4;
+    }
+    walker.visit = visit;
+    walker.arg = arg;
+    if (options != NULL) {
+        walker.options = *options;
+    }
+    pthread_mutex_init(&walker.idle_lock, NULL);
+    pthread_cond_init(&walker.work_ready, NULL);
+    for (int i = 0; i < walker.num_workers; i++) {
+        pthread_mutex_init(&walker.deques[i].lock, NULL);
+    }
+
+    char *root_path = strdup("");
+    if (root_path != NULL) {
+        push_task(&walker, 0, (WalkTask){ -1, root_path, 1 });
+    }
+
+    // The calling thread is worker 0
+    pthread_t threads[WALK_MAX_WORKERS];
+    WalkWorker workers[WALK_MAX_WORKERS];
+    int started = 1;
+    for (int i = 0; i < walker.num_workers; i++) {
+        workers[i] = (WalkWorker){ &walker, i };
+    }
+    for (; started < walker.num_workers; started++) {
+        if (pthread_create(&threads[started], NULL, worker_main, &workers[started]) != 0) {
+            break;  // Fewer workers only make it slower
+        }
+    }
+    worker_main(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < walker.num_workers; i++) {
+        free(walker.deques[i].tasks);
+        pthread_mutex_destroy(&walker.deques[i].lock);
+    }
+    pthread_mutex_destroy(&walker.idle_lock);
+    pthread_cond_destroy(&walker.work_ready);
+    close(walker.root_fd);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include "ignore.h"
+
+#define WALK_MAX_WORKERS 32    // Threads used by one walk at most
+#define WALK_OPEN_FDS 1024     // Most queued directories kept open, across all workers
+
+typedef enum WalkType {
+    WALK_FILE,                 // A regular file, or a link to one
+    WALK_DIR,                  // A directory, or a link to one
+    WALK_OTHER
+} WalkType;
+
+// One directory entry ("." and ".." are never reported)
+typedef struct WalkEntry {
+    int dir_fd;                // The directory it is in, for the *at() calls
+    const char *dir;           // Path of that directory relative to the root ("" for the root)
+    const char *name;
+    WalkType type;
+    int is_link;               // Links are reported, but never followed into
+    int depth;                 // 1 for the entries of the root itself
+} WalkEntry;
+
+// What the walk does after an entry was reported
+typedef enum WalkAction {
+    WALK_CONTINUE,
+    WALK_PRUNE,                // Do not go into this directory
+    WALK_STOP                  // End the whole walk as soon as possible
+} WalkAction;
+
+// Limits on what is visited. Pruned directories are never opened.
+typedef struct WalkOptions {
+    int max_depth;             // Deepest entries visited, or 0 for no limit
+    int ignore;                // IGNORE_SEEK and IGNORE_GIT: skip what the ignore files name
+} WalkOptions;
+
+// Called for every entry below the root. worker (0 <= worker < the number
+// returned by walk_workers) tells which thread is calling, so per-worker
+// state needs no locking; calls from different workers run concurrently.
+typedef WalkAction (*walk_callback)(const WalkEntry *entry, int worker, void *arg);
+
+// Number of threads walk_tree will use
+int walk_workers(void);
+
+// Visits every entry below root. Directories are spread over the workers,
+// each taking the newest directory from its own queue and, once that is
+// empty, stealing the oldest from another's. Entries are read relative to
+// their directory's descriptor and only stat'ed when readdir cannot tell
+// their type. options may be NULL. After WALK_STOP, the directories still
+// queued are dropped and the other workers stop reporting entries.
+// Returns -1 if root cannot be opened.
+int walk_tree(const char *root, const WalkOptions *options, walk_callback visit, void *arg);
+
+#endif // WALK_H